@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/** @brief SyscallWinDrawBatch に渡す描画命令の種類． */
+enum DrawCommandType {
+    kDrawFill = 1,
+    kDrawLine,
+    kDrawText,
+    kDrawBlit,
+};
+
+/** @brief kDrawText の文字列の最大バイト数（NUL を含む）． */
+enum { kDrawTextMaxBytes = 256 };
+
+/** @brief 描画命令．命令はバッファに隙間なく並べ，size は後ろに続くデータを含めた
+ * 命令全体のバイト数（8 の倍数）．座標はすべてウィンドウ全体のもの．
+ *
+ * - kDrawFill : (x, y) から幅 w，高さ h を color で塗る
+ * - kDrawLine : (x, y) から (w, h) まで color で線を引く
+ * - kDrawText : (x, y) に color で，後ろに続く NUL 終端の文字列を書く．
+ *               文字列は NUL を含めて kDrawTextMaxBytes バイトまで
+ * - kDrawBlit : (x, y) に幅 w，高さ h の画像を写す．後ろに 0xRRGGBB の画素が w * h 個続く
+ */
+struct DrawCommand {
+    uint32_t type;
+    uint32_t size;
+    int32_t x, y;
+    int32_t w, h;
+    uint32_t color;
+    uint32_t reserved;
+};
+
+#ifdef __cplusplus
+}
+#endif
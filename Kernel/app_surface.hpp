@@ -0,0 +1,27 @@
+#pragma once
+
+#include "frame_buffer_config.hpp"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/** @brief SyscallMapWindow がアプリに返す，ウィンドウの画素の並び．
+ *
+ * 座標はタイトルバーや枠を含むウィンドウ全体のもの．1 画素は 32 ビットで，
+ * format が kPixelBGRResv8BitPerColor なら 0x00RRGGBB，
+ * kPixelRGBResv8BitPerColor なら 0x00BBGGRR の形で書く．
+ * 書き込んだだけでは画面に出ないので，SyscallWinDamage で書いた範囲を知らせる．
+ */
+struct WindowSurface {
+    /** @brief 左上 (0, 0) の画素． */
+    uint32_t* pixels;
+    int width, height;
+    /** @brief 1 行の画素数．width 以上． */
+    int stride;
+    enum PixelFormat format;
+};
+
+#ifdef __cplusplus
+}
+#endif
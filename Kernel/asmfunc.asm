@@ -96,6 +96,16 @@ GetCR3:
     mov rax, cr3
     ret
 
+global GetCR4   ; uint64_t GetCR4();
+GetCR4:
+    mov rax, cr4
+    ret
+
+global SetCR4   ; void SetCR4(uint64_t value);
+SetCR4:
+    mov cr4, rdi
+    ret
+
 extern kernel_main_stack
 extern KernelMainNewStack
 
@@ -145,7 +155,7 @@ SwitchContext:    ; void SwitchContext(void* next_ctx, void* current_ctx);
     mov dx, gs
     mov [rsi + 0x38], rdx
 
-    fxsave [rsi + 0xc0]
+    ; FPU/SSE の状態は遅延切り替え（#NM）で保存するのでここでは扱わない
 	; fall through to RestoreContext
 
 global RestoreContext
@@ -158,8 +168,6 @@ RestoreContext:  ; void RestoreContext(void* task_context);
     push qword [rdi + 0x08] ; RIP
 
     ; コンテキストの復帰
-    fxrstor [rdi + 0xc0]
-
     mov rax, [rdi + 0x00]
     mov cr3, rax
     mov rax, [rdi + 0x30]
@@ -213,6 +221,15 @@ IntHandlerLAPICTimer:   ;void IntHandlerLAPICTimer();
     push rbp
     mov rbp, rsp
 
+    ; CR0.TS が立っていても割り込み処理中は FPU を使えるようにする．
+    ; 割り込み前の CR0 は [rbp - 16] に取っておき，戻るときに TS を戻す．
+    push rax
+    mov rax, cr0
+    push rax
+    clts
+    mov rax, [rbp - 8]
+
+    ; 割り込まれた時点の FPU レジスタ（持ち主は現在のタスクとは限らない）を退避
     sub rsp, 512
     fxsave [rsp]
     push r15
@@ -266,10 +283,50 @@ IntHandlerLAPICTimer:   ;void IntHandlerLAPICTimer();
     pop r15
     fxrstor [rsp]
 
+    test qword [rbp - 16], 8    ; CR0.TS
+    jz .ts_clear
+    mov rax, cr0
+    or rax, 8
+    mov cr0, rax
+    mov rax, [rbp - 8]
+.ts_clear:
     mov rsp, rbp
     pop rbp
     iretq
 
+extern NMOnInterrupt
+; void NMOnInterrupt();
+
+; CR0.TS が立った状態で FPU が使われた（#NM）．遅延していた FPU の切り替えを行う．
+; C の割り込みハンドラは入口で XMM を退避することがあり，TS が立ったままだと
+; そこで再び #NM になるので，先に CLTS してから C を呼ぶ．
+; XMM は NMOnInterrupt が入れ替えるので，ここでは退避も復元もしない．
+global IntHandlerNM
+IntHandlerNM:   ; void IntHandlerNM();
+    clts
+    ; 割り込みフレーム（5 * 8 バイト）と合わせて 16 バイト境界に揃う
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    cld
+    call NMOnInterrupt
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+    iretq
+
 global LoadTR
 LoadTR:     ;void LoadTR(uint16_t sel);
     ltr di
@@ -366,3 +423,42 @@ global InvalidateTLB    ; void InvalidateTLB(uint64_t addr);
 InvalidateTLB:
     invlpg [rdi]
     ret
+
+global ReadMSR  ; uint64_t ReadMSR(uint32_t msr);
+ReadMSR:
+    mov ecx, edi
+    rdmsr
+    shl rdx, 32
+    or rax, rdx
+    ret
+
+global ReadTSC  ; uint64_t ReadTSC(void);
+ReadTSC:
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    ret
+
+global XSetBV   ; void XSetBV(uint32_t xcr, uint64_t value);
+XSetBV:
+    mov ecx, edi
+    mov eax, esi
+    mov rdx, rsi
+    shr rdx, 32
+    xsetbv
+    ret
+
+global CPUID    ; void CPUID(uint32_t eax, uint32_t ecx, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d);
+CPUID:
+    push rbx
+    mov r10, rdx    ; a
+    mov r11, rcx    ; b
+    mov eax, edi
+    mov ecx, esi
+    cpuid
+    mov [r10], eax
+    mov [r11], ebx
+    mov [r8], ecx
+    mov [r9], edx
+    pop rbx
+    ret
@@ -16,13 +16,21 @@ extern "C" {
   uint64_t GetCR2();
   void SetCR3(uint64_t value);
   uint64_t GetCR3();
+  uint64_t GetCR4();
+  void SetCR4(uint64_t value);
   void SwitchContext(void* next_ctx, void* current_ctx);
   void RestoreContext(void* ctx);
   int CallApp(int argc, char** argv, uint16_t ss, uint64_t rip, uint64_t rsp, uint64_t* os_stack_ptr);
   void IntHandlerLAPICTimer();
+  void IntHandlerNM();
   void LoadTR(uint16_t sel);
   void WriteMSR(uint32_t msr, uint64_t value);
   void SyscallEntry(void);
   void ExitApp(uint64_t rsp, int32_t ret_val);
   void InvalidateTLB(uint64_t addr);
+  uint64_t ReadMSR(uint32_t msr);
+  uint64_t ReadTSC(void);
+  void XSetBV(uint32_t xcr, uint64_t value);
+  void CPUID(uint32_t eax, uint32_t ecx,
+             uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d);
 }
@@ -0,0 +1,64 @@
+#include "boot_option.hpp"
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "fat.hpp"
+#include "logger.hpp"
+
+namespace {
+    std::map<std::string, std::string>* boot_options;
+
+    void ParseLine(const char* line, size_t len) {
+        while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' ')) {
+            --len;
+        }
+        if (len == 0 || line[0] == '#') {
+            return;
+        }
+
+        auto eq = static_cast<const char*>(memchr(line, '=', len));
+        if (eq == nullptr) {
+            Log(kWarn, "BOOT.CFG: ignored '%.*s'\n", static_cast<int>(len), line);
+            return;
+        }
+        (*boot_options)[std::string(line, eq)] = std::string(eq + 1, line + len);
+    }
+}
+
+void LoadBootOptions() {
+    boot_options = new std::map<std::string, std::string>;
+
+    auto [entry, post_slash] = fat::Findfile("/boot.cfg");
+    if (entry == nullptr || post_slash) {
+        return;
+    }
+
+    std::vector<char> buf(entry->file_size);
+    const size_t len = fat::LoadFile(buf.data(), buf.size(), *entry);
+
+    size_t line_begin = 0;
+    for (size_t i = 0; i <= len; ++i) {
+        if (i == len || buf[i] == '\n') {
+            ParseLine(buf.data() + line_begin, i - line_begin);
+            line_begin = i + 1;
+        }
+    }
+
+    for (const auto& [key, value] : *boot_options) {
+        Log(kInfo, "boot option: %s=%s\n", key.c_str(), value.c_str());
+    }
+}
+
+const char* BootOption(const char* key, const char* default_value) {
+    if (boot_options == nullptr) {
+        return default_value;
+    }
+    auto it = boot_options->find(key);
+    if (it == boot_options->end()) {
+        return default_value;
+    }
+    return it->second.c_str();
+}
@@ -0,0 +1,14 @@
+/**
+ * @file boot_option.hpp
+ *
+ * 起動時にボリュームのルートにある BOOT.CFG から設定を読み込むプログラム．
+ * BOOT.CFG は 1 行に 1 つずつ "key=value" を書く．"#" で始まる行は無視する．
+ */
+
+#pragma once
+
+/** @brief BOOT.CFG を読み込む．fat::Initialize の後に呼ぶこと． */
+void LoadBootOptions();
+
+/** @brief key に対応する値を返す．設定されていなければ default_value を返す． */
+const char* BootOption(const char* key, const char* default_value = nullptr);
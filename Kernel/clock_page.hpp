@@ -0,0 +1,35 @@
+/**
+ * @file clock_page.hpp
+ *
+ * アプリのアドレス空間に読み取り専用で見せる時計ページの定義．
+ * カーネルとアプリの両方からインクルードされる．
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/** @brief 時計ページをマップするアプリ側の仮想アドレス．アプリのスタックの直下． */
+#define CLOCK_PAGE_ADDR 0xfffffffffffee000ull
+
+/** @brief 時計ページの中身．
+ *
+ * カーネルは sequence を奇数にしてから書き換え，書き終えたら偶数に戻す．
+ * 読む側は sequence が偶数かつ読む前後で変わっていないことを確かめる．
+ */
+struct ClockPage {
+    volatile uint32_t sequence;
+    uint32_t timer_freq;
+    /** @brief カーネルが処理済みの tick．tickless 時は遅れていることがある． */
+    volatile uint64_t tick;
+    /** @brief 時計の 0 ナノ秒に対応する TSC の値． */
+    uint64_t tsc_base;
+    /** @brief ns = ((TSC - tsc_base) * tsc_ns_mult) >> 32．invariant TSC が無ければ 0． */
+    uint64_t tsc_ns_mult;
+};
+
+#ifdef __cplusplus
+}
+#endif
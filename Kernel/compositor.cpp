@@ -0,0 +1,128 @@
+#include "compositor.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include "boot_option.hpp"
+#include "file.hpp"
+#include "interrupt.hpp"
+#include "layer.hpp"
+#include "logger.hpp"
+#include "task.hpp"
+#include "timer.hpp"
+
+namespace {
+    const int kMinFPS = 1;
+    const int kMaxFPS = kTimerFreq;
+    const uint64_t kNanosecondsPerSec = 1'000'000'000;
+}
+
+Compositor* compositor;
+
+Compositor::Compositor(LayerManager& manager, int fps)
+    : manager_{manager}, fps_{fps}, frame_ns_{kNanosecondsPerSec / fps} {
+}
+
+void Compositor::Start() {
+    const auto rflags = SaveAndDisableInterrupts();
+    next_frame_ns_ = timer_manager->CurrentTimeNs() + frame_ns_;
+    ScheduleNextFrame();
+    RestoreInterrupts(rflags);
+    manager_.SetDeferred(true);
+}
+
+void Compositor::Frame() {
+    auto rflags = SaveAndDisableInterrupts();
+    const auto now = timer_manager->CurrentTimeNs();
+    RestoreInterrupts(rflags);
+
+    // 予定時刻から 1 フレーム以上遅れていたら，その間のフレームは飛ばしたことになる
+    if (now >= next_frame_ns_ + frame_ns_) {
+        const auto late = (now - next_frame_ns_) / frame_ns_;
+        stats_.dropped_frames += late;
+        next_frame_ns_ += late * frame_ns_;
+    }
+    next_frame_ns_ += frame_ns_;
+
+    uint64_t area;
+    {
+        LockGuard lock{manager_.GetLock()};
+        area = manager_.Flush();
+    }
+    if (area == 0) {
+        ++stats_.idle_frames;
+    } else {
+        rflags = SaveAndDisableInterrupts();
+        const auto end = timer_manager->CurrentTimeNs();
+        RestoreInterrupts(rflags);
+        ++stats_.frames;
+        stats_.last_dirty_area = area;
+        stats_.total_dirty_area += area;
+        stats_.composite_time.Add(end - now);
+    }
+
+    rflags = SaveAndDisableInterrupts();
+    for (auto task_id : waiting_tasks_) {
+        task_manager->SendMessage(task_id, Message{Message::kLayerFinish});
+    }
+    ScheduleNextFrame();
+    RestoreInterrupts(rflags);
+    waiting_tasks_.clear();
+}
+
+void Compositor::NotifyAfterFrame(uint64_t task_id) {
+    if (std::find(waiting_tasks_.begin(), waiting_tasks_.end(), task_id) ==
+        waiting_tasks_.end()) {
+        waiting_tasks_.push_back(task_id);
+    }
+}
+
+void Compositor::ResetStats() {
+    stats_ = CompositorStats{};
+}
+
+/** 割り込みを禁止した状態で呼ぶ． */
+void Compositor::ScheduleNextFrame() {
+    const unsigned long tick =
+        (next_frame_ns_ * kTimerFreq + kNanosecondsPerSec - 1) / kNanosecondsPerSec;
+    timer_manager->AddTimer(Timer{tick, kCompositorTimer, 1});
+}
+
+void InitializeCompositor() {
+    int fps = atoi(BootOption("fps", "60"));
+    if (fps < kMinFPS || kMaxFPS < fps) {
+        Log(kWarn, "invalid fps %d, using 60\n", fps);
+        fps = 60;
+    }
+
+    compositor = new Compositor{*layer_manager, fps};
+    compositor->Start();
+    Log(kInfo, "compositor: %d fps\n", fps);
+}
+
+void PrintCompositorStats(FileDescriptor& fd) {
+    // 表示中に値が変わらないように写しを取る
+    const auto rflags = SaveAndDisableInterrupts();
+    const auto stats = compositor->Stats();
+    RestoreInterrupts(rflags);
+    const auto& time = stats.composite_time;
+
+    PrintToFD(fd, "fps %d: %lu frames, %lu idle, %lu dropped\n", compositor->FPS(),
+              stats.frames, stats.idle_frames, stats.dropped_frames);
+    if (stats.frames == 0) {
+        return;
+    }
+    PrintToFD(fd, "dirty area: last %lu px, avg %lu px\n",
+              stats.last_dirty_area, stats.total_dirty_area / stats.frames);
+    PrintToFD(fd, "composite time: avg %luus, max %luus\n",
+              time.SumNs() / time.Samples() / 1000, time.MaxNs() / 1000);
+    for (int b = 0; b < LogHistogram::kBuckets; ++b) {
+        if (time.Count(b) == 0) {
+            continue;
+        }
+        if (const auto limit = LogHistogram::BucketLimitUs(b)) {
+            PrintToFD(fd, "  <%8luus %lu\n", limit, time.Count(b));
+        } else {
+            PrintToFD(fd, "  >=%7luus %lu\n", LogHistogram::BucketLimitUs(b - 1), time.Count(b));
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/**
+ * @file compositor.hpp
+ *
+ * 画面の合成を一定の間隔（フレーム）にまとめるプログラム．
+ * レイヤの操作はダメージを記録するだけにして，フレームごとに 1 回だけ合成する．
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "sched_stat.hpp"
+
+class FileDescriptor;
+class LayerManager;
+
+/** @brief フレームの開始を知らせるタイマの値．メインタスク宛てに届く． */
+const int kCompositorTimer = 2;
+
+struct CompositorStats {
+    /** @brief 合成したフレーム数． */
+    uint64_t frames;
+    /** @brief ダメージがなく合成しなかったフレーム数． */
+    uint64_t idle_frames;
+    /** @brief 前のフレームの処理が遅れて飛ばしたフレーム数． */
+    uint64_t dropped_frames;
+    /** @brief 直前のフレームと合計のダメージの画素数． */
+    uint64_t last_dirty_area;
+    uint64_t total_dirty_area;
+    /** @brief 1 フレームの合成にかかった時間． */
+    LogHistogram composite_time;
+};
+
+class Compositor {
+    public:
+        Compositor(LayerManager& manager, int fps);
+
+        /** @brief 最初のフレームのタイマを設定し，以後の描画をフレーム単位にまとめる． */
+        void Start();
+        /** @brief kCompositorTimer のタイマが切れたときに呼ぶ．溜まったダメージを合成する． */
+        void Frame();
+        /** @brief 次のフレームを合成した後に task_id へ kLayerFinish を送る． */
+        void NotifyAfterFrame(uint64_t task_id);
+
+        int FPS() const { return fps_; }
+        const CompositorStats& Stats() const { return stats_; }
+        void ResetStats();
+
+    private:
+        LayerManager& manager_;
+        const int fps_;
+        const uint64_t frame_ns_;
+        /** @brief 次のフレームの予定時刻． */
+        uint64_t next_frame_ns_{0};
+        CompositorStats stats_{};
+        std::vector<uint64_t> waiting_tasks_{};
+
+        void ScheduleNextFrame();
+};
+
+extern Compositor* compositor;
+
+/** @brief 起動オプション fps（既定 60）で compositor を作って開始する．
+ * タイマとタスクの初期化の後に呼ぶ． */
+void InitializeCompositor();
+
+/** @brief 統計を fd に書き出す． */
+void PrintCompositorStats(FileDescriptor& fd);
@@ -7,9 +7,13 @@
 #include "font.hpp"
 
 #include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
 #include <vector>
 
 #include "fat.hpp"
+#include "wait_queue.hpp"
 
 extern const uint8_t _binary_hankaku_bin_start;
 extern const uint8_t _binary_hankaku_bin_end;
@@ -18,6 +22,31 @@ extern const uint8_t _binary_hankaku_bin_size;
 FT_Library ft_library;
 std::vector<uint8_t>* nihongo_buf;
 
+namespace {
+    /** @brief 描画済みのグリフ 1 文字分．mask は上の行から並べた 1 画素 1 ビットの画像． */
+    struct CachedGlyph {
+        char32_t code;
+        /** @brief フォントにない文字なら false．"??" を描く． */
+        bool found;
+        /** @brief 文字の左上から見た画像の左上の位置． */
+        Vector2D<int> offset;
+        Vector2D<int> size;
+        int pitch;
+        std::vector<uint8_t> mask;
+    };
+
+    const size_t kGlyphCacheSize = 512;
+
+    /** @brief 16 ピクセル用の顔（face）．最初に使うときに作り，以後は使い回す． */
+    FT_Face nihongo_face16;
+    /** @brief 最近使った順（先頭が最新）のグリフ． */
+    std::list<CachedGlyph> glyph_lru;
+    std::map<char32_t, std::list<CachedGlyph>::iterator> glyph_index;
+    GlyphCacheStats glyph_stats;
+    /** @brief face と glyph_lru, glyph_index, glyph_stats を守る．FreeType の face は複数のタスクから同時に使えない． */
+    Mutex glyph_lock;
+}
+
 const uint8_t* GetFont(char c){
     auto index = 16 * static_cast<unsigned int>(c);
     if (index >= reinterpret_cast<uintptr_t>(&_binary_hankaku_bin_size)){
@@ -31,13 +60,7 @@ void WriteAscii(PixelWriter& writer, Vector2D<int> pos, char c, const PixelColor
     if(font == nullptr){
         return;
     }
-    for(int dy = 0; dy < 16; ++dy){
-        for(int dx = 0; dx < 8; ++dx){
-            if((font[dy] << dx) & 0x80u) {
-                writer.Write(pos + Vector2D<int>{dx, dy}, color);
-            } 
-        }
-    }
+    writer.WriteMask(pos, {8, 16}, font, 1, color);
 }
 
 int CountUTF8Size(uint8_t c){
@@ -113,6 +136,72 @@ Error RenderUnicode(char32_t c, FT_Face face){
     return MAKE_ERROR(Error::kSuccess);
 }
 
+namespace {
+    /** @brief c を描画してグリフを作る．フォントにない文字は found = false のグリフにする． */
+    Error RenderGlyph(char32_t c, CachedGlyph& glyph) {
+        if (nihongo_face16 == nullptr) {
+            auto [ face, err ] = NewFTFace();
+            if (err) {
+                FT_Done_Face(face);
+                return err;
+            }
+            nihongo_face16 = face;
+        }
+        FT_Face face = nihongo_face16;
+
+        // 追い出したグリフの mask の領域はそのまま使い回す
+        glyph.code = c;
+        glyph.found = false;
+        glyph.mask.clear();
+        if (RenderUnicode(c, face)) {
+            return MAKE_ERROR(Error::kSuccess);
+        }
+
+        const FT_Bitmap& bitmap = face->glyph->bitmap;
+        const int baseline = (face->height + face->descender) *
+                        face->size->metrics.y_ppem / face->units_per_EM;
+        const int pitch = bitmap.pitch < 0 ? -bitmap.pitch : bitmap.pitch;
+
+        glyph.found = true;
+        glyph.offset = {face->glyph->bitmap_left, baseline - face->glyph->bitmap_top};
+        glyph.size = {static_cast<int>(bitmap.width), static_cast<int>(bitmap.rows)};
+        glyph.pitch = pitch;
+        glyph.mask.resize(pitch * bitmap.rows);
+        // pitch が負なら下の行から並んでいるので，上の行から並べ直す
+        for (unsigned int y = 0; y < bitmap.rows; ++y) {
+            const auto row = bitmap.pitch < 0 ? bitmap.rows - 1 - y : y;
+            memcpy(&glyph.mask[pitch * y], bitmap.buffer + pitch * row, pitch);
+        }
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    /** @brief c のグリフをキャッシュから探し，なければ描画して加える．glyph_lock を取って呼ぶ． */
+    WithError<const CachedGlyph*> FindGlyph(char32_t c) {
+        if (auto it = glyph_index.find(c); it != glyph_index.end()) {
+            ++glyph_stats.hits;
+            glyph_lru.splice(glyph_lru.begin(), glyph_lru, it->second);
+            return { &*it->second, MAKE_ERROR(Error::kSuccess) };
+        }
+
+        ++glyph_stats.misses;
+        if (glyph_lru.size() >= kGlyphCacheSize) {
+            // 最も長く使っていないグリフの領域を使い回す
+            ++glyph_stats.evictions;
+            glyph_index.erase(glyph_lru.back().code);
+            glyph_lru.splice(glyph_lru.begin(), glyph_lru, std::prev(glyph_lru.end()));
+        } else {
+            glyph_lru.emplace_front();
+        }
+
+        if (auto err = RenderGlyph(c, glyph_lru.front())) {
+            glyph_lru.pop_front();
+            return { nullptr, err };
+        }
+        glyph_index[c] = glyph_lru.begin();
+        return { &glyph_lru.front(), MAKE_ERROR(Error::kSuccess) };
+    }
+}
+
 Error WriteUnicode(PixelWriter& writer, Vector2D<int> pos,
                     char32_t c, const PixelColor& color){
     if(c <= 0x7f){
@@ -120,41 +209,29 @@ Error WriteUnicode(PixelWriter& writer, Vector2D<int> pos,
         return MAKE_ERROR(Error::kSuccess);
     }
 
-    auto [ face, err ] = NewFTFace();
-    if (err){
+    LockGuard lock{glyph_lock};
+    auto [ glyph, err ] = FindGlyph(c);
+    if (err || !glyph->found){
         WriteAscii(writer, pos, '?', color);
         WriteAscii(writer, pos + Vector2D<int>{8, 0}, '?', color);
-        return err;
+        return err ? err : MAKE_ERROR(Error::kFreeTypeError);
     }
 
-    if(auto err = RenderUnicode(c, face)){
-        FT_Done_Face(face);
-        WriteAscii(writer, pos, '?', color);
-        WriteAscii(writer, pos + Vector2D<int>{8, 0}, '?', color);
-        return err;
-    }
+    writer.WriteMask(pos + glyph->offset, glyph->size,
+                     glyph->mask.data(), glyph->pitch, color);
+    return MAKE_ERROR(Error::kSuccess);
+}
 
-    FT_Bitmap& bitmap = face->glyph->bitmap;
+GlyphCacheStats GetGlyphCacheStats() {
+    LockGuard lock{glyph_lock};
+    auto stats = glyph_stats;
+    stats.cached = glyph_lru.size();
+    return stats;
+}
 
-    const int baseline = (face->height + face->descender) *
-                    face->size->metrics.y_ppem / face->units_per_EM;
-    const auto glyph_topleft = pos + Vector2D<int>{
-        face->glyph->bitmap_left, baseline - face->glyph->bitmap_top};
-    
-    for(int dy = 0; dy < bitmap.rows; ++dy){
-        unsigned char* q = &bitmap.buffer[bitmap.pitch * dy];
-        if(bitmap.pitch < 0){
-            q -= bitmap.pitch * bitmap.rows;
-        }
-        for(int dx = 0; dx < bitmap.width; ++dx){
-            const bool b = q[dx >> 3] & (0x80 >> (dx & 0x7));
-            if(b){
-                writer.Write(glyph_topleft + Vector2D<int>{dx, dy}, color);
-            }
-        }
-    }
-    FT_Done_Face(face);
-    return MAKE_ERROR(Error::kSuccess);
+void ResetGlyphCacheStats() {
+    LockGuard lock{glyph_lock};
+    glyph_stats = GlyphCacheStats{};
 }
 
 void WriteString(PixelWriter& writer, Vector2D<int> pos, const char* s, const PixelColor& color){
@@ -17,3 +17,16 @@ void WriteString(PixelWriter& writer, Vector2D<int> pos, const char* s, const Pi
 Error WriteUnicode(PixelWriter& writer, Vector2D<int> pos,
                     char32_t c, const PixelColor& color);
 void InitializeFont();
+
+/** @brief WriteUnicode が使う描画済みグリフのキャッシュの統計． */
+struct GlyphCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    /** @brief 満杯のため追い出したグリフの数． */
+    uint64_t evictions;
+    /** @brief いまキャッシュにあるグリフの数．GetGlyphCacheStats が埋める． */
+    uint64_t cached;
+};
+
+GlyphCacheStats GetGlyphCacheStats();
+void ResetGlyphCacheStats();
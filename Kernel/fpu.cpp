@@ -0,0 +1,126 @@
+#include "fpu.hpp"
+
+#include <cstring>
+#include "asmfunc.h"
+#include "logger.hpp"
+
+namespace {
+    enum class SaveMode {
+        kFXSave,
+        kXSave,
+        kXSaveOpt,
+        kXSaves,
+    };
+
+    const uint64_t kCR0TaskSwitched = 1u << 3;
+    const uint64_t kCR4OSXSave = 1u << 18;
+    const uint32_t kIA32_XSS = 0x00000da0;
+    /** @brief x87, SSE, AVX．AVX-512 はタスクごとの保存領域が大きくなるので有効にしない． */
+    const uint64_t kXCR0Wanted = 0x7;
+
+    SaveMode save_mode = SaveMode::kFXSave;
+    uint64_t enabled_features = 0x3;
+    size_t state_bytes = 512;
+    alignas(kFPUStateAlign) uint8_t initial_state[4096];
+}
+
+void InitializeFPU() {
+    uint32_t eax, ebx, ecx, edx;
+    CPUID(1, 0, &eax, &ebx, &ecx, &edx);
+    const bool xsave_supported = (ecx >> 26) & 1;
+
+    if (xsave_supported) {
+        SetCR4(GetCR4() | kCR4OSXSave);
+        CPUID(0xd, 0, &eax, &ebx, &ecx, &edx);
+        const uint64_t xcr0 = ((static_cast<uint64_t>(edx) << 32) | eax) & kXCR0Wanted;
+        XSetBV(0, xcr0);
+        enabled_features = xcr0;
+
+        CPUID(0xd, 0, &eax, &ebx, &ecx, &edx);
+        state_bytes = ebx; // 現在の XCR0 で必要な大きさ
+        save_mode = SaveMode::kXSave;
+
+        CPUID(0xd, 1, &eax, &ebx, &ecx, &edx);
+        if ((eax >> 3) & 1) {
+            WriteMSR(kIA32_XSS, 0);
+            CPUID(0xd, 1, &eax, &ebx, &ecx, &edx);
+            state_bytes = ebx; // compacted 形式での大きさ
+            save_mode = SaveMode::kXSaves;
+        } else if (eax & 1) {
+            save_mode = SaveMode::kXSaveOpt;
+        }
+    }
+
+    if (state_bytes > sizeof(initial_state)) {
+        Log(kError, "FPU state too large: %lu bytes\n", state_bytes);
+        save_mode = SaveMode::kFXSave;
+        state_bytes = 512;
+        enabled_features = 0x3;
+        XSetBV(0, enabled_features);
+    }
+
+    SetFPUTrap(false);
+    const uint32_t mxcsr = 0x1f80;
+    __asm__ volatile("fninit\n\tldmxcsr %0" :: "m"(mxcsr));
+    memset(initial_state, 0, sizeof(initial_state));
+    SaveFPUState(initial_state);
+
+    Log(kInfo, "FPU: save mode %d, %lu bytes per task\n",
+        static_cast<int>(save_mode), state_bytes);
+}
+
+uint64_t FPUFeatures() {
+    return enabled_features;
+}
+
+size_t FPUStateBytes() {
+    return state_bytes;
+}
+
+void InitFPUState(uint8_t* area) {
+    memcpy(area, initial_state, state_bytes);
+}
+
+void SaveFPUState(uint8_t* area) {
+    switch (save_mode) {
+    case SaveMode::kFXSave:
+        __asm__ volatile("fxsave64 (%0)" :: "r"(area) : "memory");
+        break;
+    case SaveMode::kXSave:
+        __asm__ volatile("xsave64 (%0)" :: "r"(area), "a"(~0u), "d"(~0u) : "memory");
+        break;
+    case SaveMode::kXSaveOpt:
+        __asm__ volatile("xsaveopt64 (%0)" :: "r"(area), "a"(~0u), "d"(~0u) : "memory");
+        break;
+    case SaveMode::kXSaves:
+        __asm__ volatile("xsaves64 (%0)" :: "r"(area), "a"(~0u), "d"(~0u) : "memory");
+        break;
+    }
+}
+
+void RestoreFPUState(const uint8_t* area) {
+    switch (save_mode) {
+    case SaveMode::kFXSave:
+        __asm__ volatile("fxrstor64 (%0)" :: "r"(area) : "memory");
+        break;
+    case SaveMode::kXSave:
+    case SaveMode::kXSaveOpt:
+        __asm__ volatile("xrstor64 (%0)" :: "r"(area), "a"(~0u), "d"(~0u) : "memory");
+        break;
+    case SaveMode::kXSaves:
+        __asm__ volatile("xrstors64 (%0)" :: "r"(area), "a"(~0u), "d"(~0u) : "memory");
+        break;
+    }
+}
+
+void RestoreFXSaveArea(const uint8_t* area) {
+    __asm__ volatile("fxrstor64 (%0)" :: "r"(area) : "memory");
+}
+
+void SetFPUTrap(bool trap) {
+    const uint64_t cr0 = GetCR0();
+    const uint64_t new_cr0 = trap ? (cr0 | kCR0TaskSwitched) : (cr0 & ~kCR0TaskSwitched);
+    if (new_cr0 != cr0) {
+        SetCR0(new_cr0);
+    }
+}
@@ -0,0 +1,34 @@
+/**
+ * @file fpu.hpp
+ *
+ * FPU/SSE/AVX の状態の保存と復帰を行うプログラムを集めたファイル．
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/** @brief 使える命令を調べて XSAVE 系の命令を有効にし，初期状態の保存領域を作る．
+ *
+ * XSAVES > XSAVEOPT > XSAVE > FXSAVE の順に使える命令を選ぶ．
+ */
+void InitializeFPU();
+
+/** @brief XCR0 に設定した，OS が保存・復帰する状態の集合．XSAVE が無ければ 0x3（x87, SSE）． */
+uint64_t FPUFeatures();
+const uint64_t kFPUFeatureAVX = 1u << 2;
+
+/** @brief タスクごとの保存領域の大きさ（バイト）．領域は kFPUStateAlign に揃えること． */
+size_t FPUStateBytes();
+const size_t kFPUStateAlign = 64;
+
+/** @brief 保存領域を FNINIT 直後の状態（MXCSR = 0x1f80）で初期化する． */
+void InitFPUState(uint8_t* area);
+void SaveFPUState(uint8_t* area);
+void RestoreFPUState(const uint8_t* area);
+/** @brief 割り込みハンドラが FXSAVE した 512 バイトの領域から FPU レジスタを戻す． */
+void RestoreFXSaveArea(const uint8_t* area);
+
+/** @brief CR0.TS を設定する．立てると次に FPU を使ったときに #NM が起きる． */
+void SetFPUTrap(bool trap);
@@ -1,5 +1,9 @@
 #include "frame_buffer.hpp"
 
+#include <cstring>
+#include "memory_manager.hpp"
+#include "pixel_ops.hpp"
+
 namespace {
     int BytesPerPixel(PixelFormat format){
         switch(format){
@@ -32,22 +36,37 @@ Error FrameBuffer::Initialize(const FrameBufferConfig& config) {
         return MAKE_ERROR(Error::kUnknownPixelFormat);
     }
 
-    if(config_.frame_buffer){
-        buffer_.resize(0);
-    } else {
-        buffer_.resize(
-            bytes_per_pixel
-            * config_.horizontal_resolution * config_.vertical_resolution);
-        config_.frame_buffer = buffer_.data();
-        config_.pixels_per_scan_line = config_.horizontal_resolution;
+    if(num_frames_ > 0){
+        memory_manager->Free(FrameID{first_frame_}, num_frames_);
+        num_frames_ = 0;
+    }
+
+    device_memory_ = config_.frame_buffer != nullptr;
+    if(!config_.frame_buffer){
+        config_.pixels_per_scan_line =
+            (config_.horizontal_resolution + kScanLineAlign - 1) / kScanLineAlign * kScanLineAlign;
+        const size_t bytes = static_cast<size_t>(BytesPerScanLine(config_))
+                             * config_.vertical_resolution;
+        const size_t num_frames = (bytes + kBytesPerFrame - 1) / kBytesPerFrame;
+        if(num_frames > 0){
+            auto [frame, err] = memory_manager->Allocate(num_frames);
+            if(err){
+                config_.frame_buffer = nullptr;
+                return err;
+            }
+            first_frame_ = frame.ID();
+            num_frames_ = num_frames;
+            config_.frame_buffer = reinterpret_cast<uint8_t*>(frame.Frame());
+            memset(config_.frame_buffer, 0, bytes);
+        }
     }
 
     switch(config_.pixel_format) {
         case kPixelRGBResv8BitPerColor:
-            writer_ = std::make_unique<RGBResv8BitPerColorPixelWriter>(config_);
+            writer_ = std::make_unique<RGBResv8BitPerColorPixelWriter>(config_, device_memory_);
             break;
         case kPixelBGRResv8BitPerColor:
-            writer_ = std::make_unique<BGRResv8BitPerColorPixelWriter>(config_);
+            writer_ = std::make_unique<BGRResv8BitPerColorPixelWriter>(config_, device_memory_);
             break;
         default:
             return MAKE_ERROR(Error::kUnknownPixelFormat);
@@ -56,16 +75,30 @@ Error FrameBuffer::Initialize(const FrameBufferConfig& config) {
     return MAKE_ERROR(Error::kSuccess);
 }
 
-Error FrameBuffer::Copy(Vector2D<int> dst_pos, const FrameBuffer& src,
-                        const Rectangle<int>& src_area) {
-    if(config_.pixel_format != src.config_.pixel_format){
-        return MAKE_ERROR(Error::kUnknownPixelFormat);
+FrameBuffer::~FrameBuffer() {
+    if(num_frames_ > 0){
+        memory_manager->Free(FrameID{first_frame_}, num_frames_);
+    }
+}
+
+PixelColor FrameBuffer::At(Vector2D<int> pos) const {
+    const uint32_t v = Row(pos.y)[pos.x];
+    if(config_.pixel_format == kPixelRGBResv8BitPerColor){
+        return FromRGBResv8BitPerColor(v);
     }
+    return FromBGRResv8BitPerColor(v);
+}
 
+Error FrameBuffer::Copy(Vector2D<int> dst_pos, const FrameBuffer& src,
+                        const Rectangle<int>& src_area) {
     const auto bytes_per_pixel = BytesPerPixel(config_.pixel_format);
-    if(bytes_per_pixel <= 0){
+    if(bytes_per_pixel != 4 || BytesPerPixel(src.config_.pixel_format) != 4){
         return MAKE_ERROR(Error::kUnknownPixelFormat);
     }
+    // 形式が違っても，どちらも 32 ビットなので R と B を入れ替えるだけでよい
+    const bool swap_rb = config_.pixel_format != src.config_.pixel_format;
+    const auto copy_row = swap_rb ? (device_memory_ ? pixel_ops->swap_rb_nt : pixel_ops->swap_rb)
+                        : device_memory_ ? pixel_ops->copy_nt : pixel_ops->copy;
 
     const Rectangle<int> src_area_shifted{dst_pos, src_area.size};
     const Rectangle<int> src_outline{dst_pos - src_area.pos, FrameBufferSize(src.config_)};
@@ -76,8 +109,12 @@ Error FrameBuffer::Copy(Vector2D<int> dst_pos, const FrameBuffer& src,
     uint8_t* dst_buf = FrameAddrAt(copy_area.pos, config_);
     const uint8_t* src_buf = FrameAddrAt(src_start_pos, src.config_);
 
+    if(copy_area.size.x <= 0){
+        return MAKE_ERROR(Error::kSuccess);
+    }
     for(int y = 0; y < copy_area.size.y; ++y){
-        memcpy(dst_buf, src_buf, bytes_per_pixel * copy_area.size.x);
+        copy_row(reinterpret_cast<uint32_t*>(dst_buf),
+                 reinterpret_cast<const uint32_t*>(src_buf), copy_area.size.x);
         dst_buf += BytesPerScanLine(config_);
         src_buf += BytesPerScanLine(src.config_);
     }
@@ -88,12 +125,24 @@ Error FrameBuffer::Copy(Vector2D<int> dst_pos, const FrameBuffer& src,
 void FrameBuffer::Move(Vector2D<int> dst_pos, const Rectangle<int>& src){
     const auto bytes_per_pixel = BytesPerPixel(config_.pixel_format);
     const auto bytes_per_scan_line = BytesPerScanLine(config_);
+    if (src.size.x <= 0) {
+        return;
+    }
+    // 行が違えば 1 行の中で重なることはないので速い複写を使う
+    auto copy_row = [&](uint8_t* dst_row, const uint8_t* src_row) {
+        if (dst_pos.y == src.pos.y) {
+            memmove(dst_row, src_row, bytes_per_pixel * src.size.x);
+        } else {
+            pixel_ops->copy(reinterpret_cast<uint32_t*>(dst_row),
+                            reinterpret_cast<const uint32_t*>(src_row), src.size.x);
+        }
+    };
 
   if (dst_pos.y < src.pos.y) { // move up
         uint8_t* dst_buf = FrameAddrAt(dst_pos, config_);
         const uint8_t* src_buf = FrameAddrAt(src.pos, config_);
         for(int y = 0; y < src.size.y; ++y){
-            memcpy(dst_buf, src_buf, bytes_per_pixel * src.size.x);
+            copy_row(dst_buf, src_buf);
             dst_buf += bytes_per_scan_line;
             src_buf += bytes_per_scan_line;
         }
@@ -101,7 +150,7 @@ void FrameBuffer::Move(Vector2D<int> dst_pos, const Rectangle<int>& src){
         uint8_t* dst_buf = FrameAddrAt(dst_pos + Vector2D<int>{0, src.size.y - 1}, config_);
         const uint8_t* src_buf = FrameAddrAt(src.pos + Vector2D<int> {0, src.size.y - 1}, config_);
         for (int y = 0; y < src.size.y; ++y){
-            memcpy(dst_buf, src_buf, bytes_per_pixel * src.size.x);
+            copy_row(dst_buf, src_buf);
             dst_buf -= bytes_per_scan_line;
             src_buf -= bytes_per_scan_line;
         }
@@ -1,22 +1,51 @@
 #pragma once
 
-#include <vector>
+#include <cstddef>
 #include <memory>
 
 #include "frame_buffer_config.hpp"
 #include "graphics.hpp"
 #include "error.hpp"
 
+/** @brief 1 画素 32 ビットの画素の並び．
+ *
+ * Initialize に frame_buffer を渡さなければ，メモリをページ単位で確保する．
+ * 1 行の画素数（pixels_per_scan_line）は kScanLineAlign の倍数に切り上げ，
+ * 各行の先頭がキャッシュラインの境界に揃うようにする．
+ */
 class FrameBuffer {
     public:
+        static const uint32_t kScanLineAlign = 16;
+
+        FrameBuffer() = default;
+        ~FrameBuffer();
+        FrameBuffer(const FrameBuffer&) = delete;
+        FrameBuffer& operator=(const FrameBuffer&) = delete;
+
         Error Initialize(const FrameBufferConfig& config);
   Error Copy(Vector2D<int> dst_pos, const FrameBuffer& src, const Rectangle<int>& src_area);
         void Move(Vector2D<int> dst_pos, const Rectangle<int>& src);
 
         FrameBufferWriter& Writer() { return *writer_; }
         const FrameBufferConfig& Config() const { return config_; }
+        /** @brief y 行目の先頭の画素． */
+        uint32_t* Row(int y) {
+            return reinterpret_cast<uint32_t*>(config_.frame_buffer) + config_.pixels_per_scan_line * y;
+        }
+        const uint32_t* Row(int y) const {
+            return reinterpret_cast<const uint32_t*>(config_.frame_buffer) + config_.pixels_per_scan_line * y;
+        }
+        PixelColor At(Vector2D<int> pos) const;
+        /** @brief 自分で確保したメモリのフレーム数．外から与えられたメモリなら 0．
+         * メモリはアイデンティティマップなので，先頭の物理アドレスは Row(0) と同じ． */
+        size_t NumFrames() const { return num_frames_; }
     private:
         FrameBufferConfig config_{};
-        std::vector<uint8_t> buffer_{};
+        /** @brief 自分で確保したメモリの先頭のフレーム番号と数．確保していなければ 0 個． */
+        size_t first_frame_{0};
+        size_t num_frames_{0};
         std::unique_ptr<FrameBufferWriter> writer_{};
+        /** @brief 外から与えられたメモリ（GOP のフレームバッファ）なら true．
+         * 読み返さないので，書き込みにキャッシュを汚さない命令を使う． */
+        bool device_memory_{false};
 };
@@ -0,0 +1,92 @@
+#include "futex.hpp"
+
+#include <array>
+#include <cerrno>
+
+#include "interrupt.hpp"
+#include "paging.hpp"
+#include "wait_queue.hpp"
+
+namespace {
+    /** @brief 物理アドレスのハッシュで選ぶ待ち行列．同じ行列に別のキーが混ざってもよい． */
+    std::array<WaitQueue, 64> futex_queues;
+
+    WaitQueue& QueueOf(uint64_t key) {
+        const uint64_t h = (key >> 2) * 0x9e3779b97f4a7c15ull;
+        return futex_queues[h >> 58];
+    }
+
+    /** @brief addr の物理アドレスを求める．まだ割り当てていないページなら割り当てる．
+     * 割り込みを禁止した状態で呼ぶ．
+     *
+     * 読み込み専用のコピーオンライトのページは，ここで書き込みと同じように複製してから求める．
+     * そうしないと，まだ書いていない待ち手は複製元のページを，書いた起こし手は複製後のページを
+     * キーにしてしまい起こし損ねる．同じプログラムを動かす別のアプリともキーが重なる．
+     */
+    WithError<uint64_t> FutexKey(uint64_t addr) {
+        if (addr < 0xffff'8000'0000'0000 || addr % sizeof(uint32_t) != 0) {
+            return {0, MAKE_ERROR(Error::kIndexOutOfRange)};
+        }
+
+        const uint64_t kPresent = 1 << 0;
+        const uint64_t kWriteAccess = 1 << 1;
+        const uint64_t kUserAccess = 1 << 2;
+
+        bool writable;
+        auto res = LinearToPhysical(addr, &writable);
+        if (res.error) {
+            // デマンドページングやファイルマップの範囲なら，ここでページを用意する
+            if (auto err = HandlePageFault(kUserAccess, addr)) {
+                return {0, err};
+            }
+            res = LinearToPhysical(addr, &writable);
+        }
+        if (res.error || writable) {
+            return res;
+        }
+        // 時計ページのように書き込めないページ（kAlreadyAllocated）はそのままキーにする
+        if (auto err = HandlePageFault(kPresent | kWriteAccess | kUserAccess, addr);
+            err && err.Cause() != Error::kAlreadyAllocated) {
+            return {0, err};
+        }
+        return LinearToPhysical(addr);
+    }
+}
+
+int FutexWait(uint64_t addr, uint32_t expected) {
+    const auto rflags = SaveAndDisableInterrupts();
+    auto [key, err] = FutexKey(addr);
+    if (err) {
+        RestoreInterrupts(rflags);
+        return EFAULT;
+    }
+
+    auto value = reinterpret_cast<volatile uint32_t*>(addr);
+    if (*value != expected) {
+        RestoreInterrupts(rflags);
+        return EAGAIN;
+    }
+
+    auto& queue = QueueOf(key);
+    while (!queue.Wait(key)) {
+        // メッセージの到着などで起こされた．値が変わっていなければ待ち直す
+        if (*value != expected) {
+            break;
+        }
+    }
+    RestoreInterrupts(rflags);
+    return 0;
+}
+
+int FutexWake(uint64_t addr, size_t n, size_t& woken) {
+    const auto rflags = SaveAndDisableInterrupts();
+    auto [key, err] = FutexKey(addr);
+    if (err) {
+        RestoreInterrupts(rflags);
+        return EFAULT;
+    }
+
+    woken = QueueOf(key).WakeupKey(key, n);
+    RestoreInterrupts(rflags);
+    return 0;
+}
@@ -0,0 +1,26 @@
+/**
+ * @file futex.hpp
+ *
+ * アプリ同士がメモリ上の 32 ビット値を介して眠って待ち合わせる仕組み（futex）．
+ * 待ち合わせのキーは物理アドレスなので，同じ物理ページを共有していれば
+ * アドレス空間が違っても待ち合わせられる．
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/** @brief *addr が expected に等しければ FutexWake されるまで眠る．
+ *
+ * @param addr  アプリのアドレス空間の 4 バイト境界のアドレス
+ * @return 0：起こされた，EAGAIN：*addr が expected でなかった，EFAULT：addr が不正
+ */
+int FutexWait(uint64_t addr, uint32_t expected);
+
+/** @brief addr で FutexWait しているタスクを最大 n 個起こす．
+ *
+ * @param woken  起こしたタスクの数を受け取る
+ * @return 0 または EFAULT
+ */
+int FutexWake(uint64_t addr, size_t n, size_t& woken);
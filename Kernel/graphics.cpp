@@ -1,25 +1,107 @@
 #include "graphics.hpp"
 
-void RGBResv8BitPerColorPixelWriter::Write(Vector2D<int> pos, const PixelColor& c) {
-    auto p = PixelAt(pos);
-    p[0] = c.r;
-    p[1] = c.g;
-    p[2] = c.b;
+#include "pixel_ops.hpp"
+
+void PixelWriter::FillSpan(Vector2D<int> pos, int len, const PixelColor& c) {
+    for(int dx = 0; dx < len; ++dx){
+        Write(pos + Vector2D<int>{dx, 0}, c);
+    }
+}
+
+void PixelWriter::FillRect(Vector2D<int> pos, Vector2D<int> size, const PixelColor& c) {
+    for(int dy = 0; dy < size.y; ++dy){
+        FillSpan(pos + Vector2D<int>{0, dy}, size.x, c);
+    }
+}
+
+void PixelWriter::WriteRow(Vector2D<int> pos, const PixelColor* colors, int len) {
+    for(int dx = 0; dx < len; ++dx){
+        Write(pos + Vector2D<int>{dx, 0}, colors[dx]);
+    }
+}
+
+/** @brief マスクの各行をビットが続いている区間ごとに FillSpan で塗る． */
+void PixelWriter::WriteMask(Vector2D<int> pos, Vector2D<int> size,
+                            const uint8_t* mask, int pitch, const PixelColor& c) {
+    for(int dy = 0; dy < size.y; ++dy, mask += pitch){
+        int dx = 0;
+        while(dx < size.x){
+            if(!(mask[dx >> 3] & (0x80u >> (dx & 7)))){
+                ++dx;
+                continue;
+            }
+            const int begin = dx;
+            while(dx < size.x && (mask[dx >> 3] & (0x80u >> (dx & 7)))){
+                ++dx;
+            }
+            FillSpan(pos + Vector2D<int>{begin, dy}, dx - begin, c);
+        }
+    }
+}
+
+template <uint32_t (*ToPixel)(const PixelColor&)>
+void PixelWriter32<ToPixel>::Write(Vector2D<int> pos, const PixelColor& c) {
+    *PixelAt32(pos) = ToPixel(c);
+}
+
+template <uint32_t (*ToPixel)(const PixelColor&)>
+void PixelWriter32<ToPixel>::FillSpan(Vector2D<int> pos, int len, const PixelColor& c) {
+    if(len > 0){
+        const auto fill = DeviceMemory() ? pixel_ops->fill_nt : pixel_ops->fill;
+        fill(PixelAt32(pos), len, ToPixel(c));
+    }
+}
+
+template <uint32_t (*ToPixel)(const PixelColor&)>
+void PixelWriter32<ToPixel>::FillRect(Vector2D<int> pos, Vector2D<int> size,
+                                      const PixelColor& c) {
+    if(size.x <= 0){
+        return;
+    }
+    uint32_t* p = PixelAt32(pos);
+    const uint32_t v = ToPixel(c);
+    const auto fill = DeviceMemory() ? pixel_ops->fill_nt : pixel_ops->fill;
+    for(int dy = 0; dy < size.y; ++dy, p += PixelsPerScanLine()){
+        fill(p, size.x, v);
+    }
 }
 
-void BGRResv8BitPerColorPixelWriter::Write(Vector2D<int> pos, const PixelColor& c) {
-    auto p = PixelAt(pos);
-    p[0] = c.b;
-    p[1] = c.g;
-    p[2] = c.r;
+template <uint32_t (*ToPixel)(const PixelColor&)>
+void PixelWriter32<ToPixel>::WriteRow(Vector2D<int> pos, const PixelColor* colors, int len) {
+    uint32_t* p = PixelAt32(pos);
+    for(int dx = 0; dx < len; ++dx){
+        p[dx] = ToPixel(colors[dx]);
+    }
 }
 
+template <uint32_t (*ToPixel)(const PixelColor&)>
+void PixelWriter32<ToPixel>::WriteMask(Vector2D<int> pos, Vector2D<int> size,
+                                       const uint8_t* mask, int pitch, const PixelColor& c) {
+    uint32_t* p = PixelAt32(pos);
+    const uint32_t v = ToPixel(c);
+    for(int dy = 0; dy < size.y; ++dy, mask += pitch, p += PixelsPerScanLine()){
+        for(int dx = 0; dx < size.x; dx += 8){
+            const uint8_t bits = mask[dx >> 3];
+            if(bits == 0){
+                continue;
+            }
+            const int n = std::min(8, size.x - dx);
+            for(int i = 0; i < n; ++i){
+                if(bits & (0x80u >> i)){
+                    p[dx + i] = v;
+                }
+            }
+        }
+    }
+}
+
+template class PixelWriter32<ToRGBResv8BitPerColor>;
+template class PixelWriter32<ToBGRResv8BitPerColor>;
+
 void DrawRectangle(PixelWriter& writer, const Vector2D<int>& pos,
                    const Vector2D<int>& size, const PixelColor& c){
-    for(int dx = 0; dx < size.x; ++dx){
-        writer.Write(pos + Vector2D<int>{dx, 0}, c);
-        writer.Write(pos + Vector2D<int>{dx, size.y - 1}, c);
-    }
+    writer.FillSpan(pos, size.x, c);
+    writer.FillSpan(pos + Vector2D<int>{0, size.y - 1}, size.x, c);
 
     for(int dy = 1; dy < size.y -1; ++dy){
         writer.Write(pos + Vector2D<int>{0, dy}, c);
@@ -29,11 +111,7 @@ void DrawRectangle(PixelWriter& writer, const Vector2D<int>& pos,
 
 void FillRectangle(PixelWriter& writer, const Vector2D<int>& pos,
  const Vector2D<int>& size, const PixelColor& c){
-    for (int dy = 0; dy < size.y; ++dy){
-        for (int dx = 0; dx < size.x; ++dx){
-            writer.Write(pos + Vector2D<int>{dx, dy}, c);
-        }
-    }
+    writer.FillRect(pos, size, c);
 }
 
 void DrawDesktop(PixelWriter& writer){
@@ -81,11 +159,11 @@ void InitializeGraphics(const FrameBufferConfig& screen_config){
     switch(screen_config.pixel_format){
         case kPixelRGBResv8BitPerColor:
             ::screen_writer = new(pixel_writer_buf)
-            RGBResv8BitPerColorPixelWriter{screen_config};
+            RGBResv8BitPerColorPixelWriter{screen_config, true};
             break;
         case kPixelBGRResv8BitPerColor:
             ::screen_writer = new(pixel_writer_buf)
-            BGRResv8BitPerColorPixelWriter{screen_config};
+            BGRResv8BitPerColorPixelWriter{screen_config, true};
             break;
         default:
             exit(1);
@@ -86,17 +86,39 @@ Rectangle<T> operator&(const Rectangle<T>& lhs, const Rectangle<U>& rhs) {
 } 
 
 
+/** @brief 画素を書き込む先．
+ *
+ * Write 以外の一括書き込みは既定では Write を繰り返して実現する．
+ * 画素を 1 つずつ仮想関数で書くと遅いので，書き込み先ごとに上書きして高速化する．
+ * どの関数も範囲の確認はしないので，呼び出し側で Width(), Height() に収めること．
+ */
 class PixelWriter {
     public:
         virtual ~PixelWriter() = default;
         virtual void Write(Vector2D<int> pos, const PixelColor& c) = 0;
         virtual int Width() const = 0;
         virtual int Height() const = 0;
+
+        /** @brief pos から右へ len 画素を c で塗る． */
+        virtual void FillSpan(Vector2D<int> pos, int len, const PixelColor& c);
+        /** @brief pos を左上とする size の矩形を c で塗る． */
+        virtual void FillRect(Vector2D<int> pos, Vector2D<int> size, const PixelColor& c);
+        /** @brief pos から右へ len 画素を colors の色で書く． */
+        virtual void WriteRow(Vector2D<int> pos, const PixelColor* colors, int len);
+        /** @brief 1 画素 1 ビットのマスクでビットが立っている画素を c で塗る．
+         *
+         * マスクの各行は最上位ビットが左端で，次の行は pitch バイト先（負でもよい）にある．
+         */
+        virtual void WriteMask(Vector2D<int> pos, Vector2D<int> size,
+                               const uint8_t* mask, int pitch, const PixelColor& c);
 };
 
 class FrameBufferWriter : public PixelWriter {
     public:
-        FrameBufferWriter(const FrameBufferConfig& config) : config_{config}{
+        /** @brief device_memory なら config は GOP のフレームバッファで，塗りつぶしに
+         * キャッシュを汚さない書き込みを使う． */
+        FrameBufferWriter(const FrameBufferConfig& config, bool device_memory = false)
+            : config_{config}, device_memory_{device_memory}{
         }
         virtual ~FrameBufferWriter() = default;
         virtual int Width() const override { return config_.horizontal_resolution; }
@@ -105,21 +127,59 @@ class FrameBufferWriter : public PixelWriter {
         uint8_t* PixelAt(Vector2D<int> pos){
             return config_.frame_buffer + 4 * (config_.pixels_per_scan_line * pos.y + pos.x);
         }
-        
+        uint32_t* PixelAt32(Vector2D<int> pos){
+            return reinterpret_cast<uint32_t*>(PixelAt(pos));
+        }
+        int PixelsPerScanLine() const { return config_.pixels_per_scan_line; }
+        bool DeviceMemory() const { return device_memory_; }
+
     private:
         const FrameBufferConfig& config_;
+        bool device_memory_;
 };
 
-class RGBResv8BitPerColorPixelWriter : public FrameBufferWriter {
+/** @brief 1 画素 32 ビットのフレームバッファに書き込むクラス．
+ * 色の並びは ToPixel が決める．どの関数も画素を 32 ビット単位で書き込む．
+ */
+template <uint32_t (*ToPixel)(const PixelColor&)>
+class PixelWriter32 : public FrameBufferWriter {
     public:
         using FrameBufferWriter::FrameBufferWriter;
         virtual void Write(Vector2D<int> pos, const PixelColor& c) override;
+        virtual void FillSpan(Vector2D<int> pos, int len, const PixelColor& c) override;
+        virtual void FillRect(Vector2D<int> pos, Vector2D<int> size,
+                              const PixelColor& c) override;
+        virtual void WriteRow(Vector2D<int> pos, const PixelColor* colors, int len) override;
+        virtual void WriteMask(Vector2D<int> pos, Vector2D<int> size,
+                               const uint8_t* mask, int pitch, const PixelColor& c) override;
+};
+
+/** @brief メモリ上で R, G, B, 予約 の順に並ぶ形式の画素値． */
+constexpr uint32_t ToRGBResv8BitPerColor(const PixelColor& c) {
+    return uint32_t{c.r} | uint32_t{c.g} << 8 | uint32_t{c.b} << 16;
+}
+
+/** @brief メモリ上で B, G, R, 予約 の順に並ぶ形式の画素値． */
+constexpr uint32_t ToBGRResv8BitPerColor(const PixelColor& c) {
+    return uint32_t{c.b} | uint32_t{c.g} << 8 | uint32_t{c.r} << 16;
+}
+
+constexpr PixelColor FromRGBResv8BitPerColor(uint32_t v) {
+    return {static_cast<uint8_t>(v), static_cast<uint8_t>(v >> 8), static_cast<uint8_t>(v >> 16)};
+}
+
+constexpr PixelColor FromBGRResv8BitPerColor(uint32_t v) {
+    return {static_cast<uint8_t>(v >> 16), static_cast<uint8_t>(v >> 8), static_cast<uint8_t>(v)};
+}
+
+class RGBResv8BitPerColorPixelWriter : public PixelWriter32<ToRGBResv8BitPerColor> {
+    public:
+        using PixelWriter32::PixelWriter32;
 };
 
-class BGRResv8BitPerColorPixelWriter : public FrameBufferWriter {
+class BGRResv8BitPerColorPixelWriter : public PixelWriter32<ToBGRResv8BitPerColor> {
     public:
-        using FrameBufferWriter::FrameBufferWriter;
-        virtual void Write(Vector2D<int> pos, const PixelColor& c) override;
+        using PixelWriter32::PixelWriter32;
 };
 
 void DrawRectangle(PixelWriter& writer, const Vector2D<int>& pos,
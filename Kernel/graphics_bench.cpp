@@ -0,0 +1,162 @@
+#include "graphics_bench.hpp"
+
+#include "file.hpp"
+#include "font.hpp"
+#include "frame_buffer.hpp"
+#include "graphics.hpp"
+#include "layer.hpp"
+#include "pixel_ops.hpp"
+#include "timer.hpp"
+
+namespace {
+    const int kFillRepeat = 10;
+    const int kTextRepeat = 4;
+
+    /** @brief 一括書き込みを持たなかった頃と同じく，1 画素ずつ 3 バイトで書くクラス．
+     * 比較の基準にする． */
+    class BytePixelWriter : public PixelWriter {
+        public:
+            BytePixelWriter(const FrameBufferConfig& config) : config_{config} {}
+            virtual void Write(Vector2D<int> pos, const PixelColor& c) override {
+                auto p = config_.frame_buffer + 4 * (config_.pixels_per_scan_line * pos.y + pos.x);
+                if (config_.pixel_format == kPixelRGBResv8BitPerColor) {
+                    p[0] = c.r; p[1] = c.g; p[2] = c.b;
+                } else {
+                    p[0] = c.b; p[1] = c.g; p[2] = c.r;
+                }
+            }
+            virtual int Width() const override { return config_.horizontal_resolution; }
+            virtual int Height() const override { return config_.vertical_resolution; }
+        private:
+            const FrameBufferConfig& config_;
+    };
+
+    /** @brief 画面全体を kFillRepeat 回塗り，1 回あたりの時間（us）を返す． */
+    uint64_t BenchFill(PixelWriter& writer) {
+        const auto start = timer_manager->CurrentTimeNs();
+        for (int i = 0; i < kFillRepeat; ++i) {
+            const PixelColor c{static_cast<uint8_t>(i), 0x80, 0x40};
+            FillRectangle(writer, {0, 0}, {writer.Width(), writer.Height()}, c);
+        }
+        return (timer_manager->CurrentTimeNs() - start) / kFillRepeat / 1000;
+    }
+
+    /** @brief 画面全体に文字を敷き詰めて kTextRepeat 回描き，1 文字あたりの時間（ns）を返す． */
+    uint64_t BenchText(PixelWriter& writer) {
+        const int cols = writer.Width() / 8;
+        const int rows = writer.Height() / 16;
+        const auto start = timer_manager->CurrentTimeNs();
+        for (int i = 0; i < kTextRepeat; ++i) {
+            for (int y = 0; y < rows; ++y) {
+                for (int x = 0; x < cols; ++x) {
+                    const char c = '!' + (x + y + i) % ('~' - '!');
+                    WriteAscii(writer, {8 * x, 16 * y}, c, {0, 0, 0});
+                }
+            }
+        }
+        const uint64_t chars = uint64_t{1} * kTextRepeat * rows * cols;
+        return (timer_manager->CurrentTimeNs() - start) / chars;
+    }
+
+    uint64_t MBPerSec(uint64_t bytes, uint64_t us) {
+        return us == 0 ? 0 : bytes / us;
+    }
+
+    const size_t kOpsPixels = 1024 * 1024;
+    const int kOpsRepeat = 8;
+
+    /** @brief f を kOpsRepeat 回呼び，書き込んだ量から MB/s を求める． */
+    template <class F>
+    uint64_t BenchOp(size_t pixels, F f) {
+        const auto start = timer_manager->CurrentTimeNs();
+        for (int i = 0; i < kOpsRepeat; ++i) {
+            f(i);
+        }
+        const auto us = (timer_manager->CurrentTimeNs() - start) / 1000;
+        return MBPerSec(uint64_t{4} * pixels * kOpsRepeat, us);
+    }
+}
+
+void RunGraphicsBenchmark(FileDescriptor& fd) {
+    FrameBufferConfig config = screen_config;
+    config.frame_buffer = nullptr;
+    FrameBuffer buffer;
+    if (auto err = buffer.Initialize(config)) {
+        PrintToFD(fd, "failed to allocate buffer: %s\n", err.Name());
+        return;
+    }
+    BytePixelWriter byte_writer{buffer.Config()};
+    auto& bulk_writer = buffer.Writer();
+
+    const uint64_t screen_bytes = uint64_t{4} * config.horizontal_resolution
+                                  * config.vertical_resolution;
+    PrintToFD(fd, "%ux%u, %d fills, %d text passes\n",
+              config.horizontal_resolution, config.vertical_resolution,
+              kFillRepeat, kTextRepeat);
+
+    const auto fill_byte = BenchFill(byte_writer);
+    const auto fill_bulk = BenchFill(bulk_writer);
+    PrintToFD(fd, "fill per-pixel: %lu us (%lu MB/s)\n",
+              fill_byte, MBPerSec(screen_bytes, fill_byte));
+    PrintToFD(fd, "fill bulk     : %lu us (%lu MB/s)\n",
+              fill_bulk, MBPerSec(screen_bytes, fill_bulk));
+
+    const auto text_byte = BenchText(byte_writer);
+    const auto text_bulk = BenchText(bulk_writer);
+    PrintToFD(fd, "text per-pixel: %lu ns/char\n", text_byte);
+    PrintToFD(fd, "text bulk     : %lu ns/char\n", text_bulk);
+}
+
+void RunPixelOpsBenchmark(FileDescriptor& fd) {
+    // 1 画素ずらして，先頭と末尾が整列していない場合も含めて測る
+    std::vector<uint32_t> src_buf(kOpsPixels + 1), dst_buf(kOpsPixels + 1);
+    const uint32_t* src = src_buf.data() + 1;
+    uint32_t* dst = dst_buf.data() + 1;
+    const uint32_t key = 0x00ff00ff;
+    for (size_t i = 0; i < kOpsPixels; ++i) {
+        src_buf[i + 1] = (i & 3) == 0 ? key : static_cast<uint32_t>(i * 2654435761u);
+    }
+
+    uint32_t* const fb = reinterpret_cast<uint32_t*>(screen_config.frame_buffer);
+    const int fb_width = screen_config.horizontal_resolution;
+    const int fb_height = screen_config.vertical_resolution;
+    const int fb_stride = screen_config.pixels_per_scan_line;
+    const size_t fb_pixels = size_t{1} * fb_width * fb_height;
+
+    PrintToFD(fd, "MB/s     fill  fill_nt copy  copy_nt  key  swap_rb swap_nt fb_copy fb_nt\n");
+    for (const PixelOps* ops : AvailablePixelOps()) {
+        const auto fill = BenchOp(kOpsPixels, [&](int i) { ops->fill(dst, kOpsPixels, i); });
+        const auto fill_nt = BenchOp(kOpsPixels, [&](int i) { ops->fill_nt(dst, kOpsPixels, i); });
+        const auto copy = BenchOp(kOpsPixels, [&](int) { ops->copy(dst, src, kOpsPixels); });
+        const auto copy_nt = BenchOp(kOpsPixels, [&](int) { ops->copy_nt(dst, src, kOpsPixels); });
+        const auto copy_key = BenchOp(kOpsPixels, [&](int) {
+            ops->copy_key(dst, src, kOpsPixels, key);
+        });
+        const auto swap_rb = BenchOp(kOpsPixels, [&](int) { ops->swap_rb(dst, src, kOpsPixels); });
+        const auto swap_rb_nt = BenchOp(kOpsPixels, [&](int) {
+            ops->swap_rb_nt(dst, src, kOpsPixels);
+        });
+
+        // 画面への書き込みは 1 行ずつ．src の大きさに収まる範囲で繰り返す
+        auto to_screen = [&](void (*copy_row)(uint32_t*, const uint32_t*, size_t)) {
+            return BenchOp(fb_pixels, [&](int) {
+                for (int y = 0; y < fb_height; ++y) {
+                    const size_t offset = (size_t{1} * y * fb_width) % (kOpsPixels - fb_width);
+                    copy_row(fb + y * fb_stride, src + offset, fb_width);
+                }
+            });
+        };
+        uint64_t fb_copy, fb_nt;
+        {
+            // 画面に直接書くので，コンポジタやカーソルの描画と重ならないようにする
+            LockGuard lock{layer_manager->GetLock()};
+            fb_copy = to_screen(ops->copy);
+            fb_nt = to_screen(ops->copy_nt);
+            layer_manager->AddDamage({{0, 0}, ScreenSize()});
+        }
+
+        PrintToFD(fd, "%-7s %5lu %6lu %6lu %6lu %6lu %6lu %6lu %6lu %6lu\n", ops->name,
+                  fill, fill_nt, copy, copy_nt, copy_key, swap_rb, swap_rb_nt, fb_copy, fb_nt);
+    }
+    PrintToFD(fd, "using %s\n", pixel_ops->name);
+}
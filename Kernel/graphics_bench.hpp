@@ -0,0 +1,18 @@
+/**
+ * @file graphics_bench.hpp
+ *
+ * 描画処理の速さを測るベンチマーク．ターミナルの gfxbench コマンドから呼ぶ．
+ */
+
+#pragma once
+
+class FileDescriptor;
+
+/** @brief 画面と同じ大きさ・形式の裏画面に描画して，かかった時間を fd に書き出す． */
+void RunGraphicsBenchmark(FileDescriptor& fd);
+
+/** @brief pixel_ops の各実装・各処理の速さ（MB/s）を測って fd に書き出す．
+ *
+ * GOP のフレームバッファへの書き込みも測るので，測定後に画面全体を描き直す．
+ */
+void RunPixelOpsBenchmark(FileDescriptor& fd);
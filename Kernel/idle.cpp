@@ -0,0 +1,107 @@
+#include "idle.hpp"
+
+#include <array>
+#include "asmfunc.h"
+#include "interrupt.hpp"
+#include "logger.hpp"
+#include "timer.hpp"
+
+namespace {
+    struct alignas(64) CPUIdleState {
+        /** @brief MWAIT で見張る領域．書き込まれると MWAIT から抜ける． */
+        volatile uint64_t monitor;
+        uint64_t idle_cycles;
+        uint64_t window_start_tsc;
+        uint64_t window_start_idle;
+        unsigned int busy_permille;
+    };
+
+    std::array<CPUIdleState, kNumCPUs> cpu_idle_states{};
+
+    enum class IdleMethod {
+        kHLT,
+        /** @brief MWAIT の拡張（CPUID.05H:ECX[1]）で，割り込み禁止のまま割り込みで抜ける． */
+        kMWaitBreakOnInterrupt,
+        /** @brief 拡張が無いので，MWAIT の直前で割り込みを許可する． */
+        kMWait,
+    };
+    IdleMethod idle_method = IdleMethod::kHLT;
+
+    /** @brief 割り込みが来るまで CPU を休ませる．割り込み禁止の状態で呼び，禁止のまま戻る． */
+    void WaitForInterrupt(CPUIdleState& state) {
+        switch (idle_method) {
+        case IdleMethod::kMWaitBreakOnInterrupt:
+            // ECX = 1 : 割り込み禁止でも割り込みで MWAIT から抜ける
+            __asm__ volatile("monitor" :: "a"(&state.monitor), "c"(0), "d"(0));
+            __asm__ volatile("mwait" :: "a"(0), "c"(1));
+            return;
+        case IdleMethod::kMWait:
+            // HLT と同じく，STI の直後の MWAIT までは割り込みが入らない
+            __asm__ volatile("monitor" :: "a"(&state.monitor), "c"(0), "d"(0));
+            __asm__ volatile("sti\n\tmwait\n\tcli" :: "a"(0), "c"(0));
+            return;
+        case IdleMethod::kHLT:
+            break;
+        }
+        // STI の直後の命令までは割り込みが入らないので，HLT の前に割り込みを取りこぼさない
+        __asm__ volatile("sti\n\thlt\n\tcli");
+    }
+}
+
+void InitializeIdle() {
+    uint32_t eax, ebx, ecx, edx;
+    CPUID(0, 0, &eax, &ebx, &ecx, &edx);
+    const uint32_t max_leaf = eax;
+    CPUID(1, 0, &eax, &ebx, &ecx, &edx);
+    if ((ecx >> 3) & 1) {
+        idle_method = IdleMethod::kMWait;
+        if (max_leaf >= 5) {
+            // ECX[0] : MWAIT の拡張を列挙している，ECX[1] : 割り込み禁止でも割り込みで抜けられる
+            CPUID(5, 0, &eax, &ebx, &ecx, &edx);
+            if ((ecx & 0b11) == 0b11) {
+                idle_method = IdleMethod::kMWaitBreakOnInterrupt;
+            }
+        }
+    }
+    Log(kInfo, "idle: using %s\n", idle_method == IdleMethod::kHLT ? "HLT" : "MWAIT");
+
+    const auto now = ReadTSC();
+    for (auto& state : cpu_idle_states) {
+        state.window_start_tsc = now;
+    }
+}
+
+void TaskIdle(uint64_t task_id, int64_t data) {
+    auto& state = cpu_idle_states[0];
+    while (true) {
+        __asm__("cli");
+        const auto start = ReadTSC();
+        WaitForInterrupt(state);
+        state.idle_cycles += ReadTSC() - start;
+        __asm__("sti");
+    }
+}
+
+uint64_t IdleCycles(int cpu) {
+    const auto rflags = SaveAndDisableInterrupts();
+    const auto cycles = cpu_idle_states[cpu].idle_cycles;
+    RestoreInterrupts(rflags);
+    return cycles;
+}
+
+unsigned int BusyPermille(int cpu) {
+    const auto rflags = SaveAndDisableInterrupts();
+    auto& state = cpu_idle_states[cpu];
+    const auto now = ReadTSC();
+    const uint64_t elapsed = now - state.window_start_tsc;
+    if (elapsed >= tsc_freq * kUsageWindowMs / 1000) {
+        const uint64_t idle = state.idle_cycles - state.window_start_idle;
+        const uint64_t busy = idle < elapsed ? elapsed - idle : 0;
+        state.busy_permille = busy * 1000 / elapsed;
+        state.window_start_tsc = now;
+        state.window_start_idle = state.idle_cycles;
+    }
+    const unsigned int permille = state.busy_permille;
+    RestoreInterrupts(rflags);
+    return permille;
+}
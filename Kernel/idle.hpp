@@ -0,0 +1,30 @@
+/**
+ * @file idle.hpp
+ *
+ * 実行するタスクが無いときに CPU を休ませるアイドルタスクと，
+ * CPU 使用率の計測を行うプログラムを集めたファイル．
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/** @brief CPU の数．今は BSP しか動かしていないので 1． */
+const int kNumCPUs = 1;
+
+/** @brief MONITOR/MWAIT が使えるか調べる．InitializeTask の前に呼ぶ． */
+void InitializeIdle();
+
+/** @brief レベル 0 で動くアイドルタスクの本体．MWAIT か HLT で割り込みを待つ． */
+void TaskIdle(uint64_t task_id, int64_t data);
+
+/** @brief cpu のアイドル時間の合計を TSC のカウントで返す． */
+uint64_t IdleCycles(int cpu);
+
+/** @brief cpu の使用率を 0.1% 単位（0 ～ 1000）で返す．
+ *
+ * 前回計算してから kUsageWindowMs 以上たっていれば，その間の使用率を計算し直す．
+ * そうでなければ前回の値を返す．
+ */
+unsigned int BusyPermille(int cpu);
+const unsigned long kUsageWindowMs = 500;
@@ -14,8 +14,10 @@
 #include "task.hpp"
 #include "graphics.hpp"
 #include "font.hpp"
+#include "kernel_stack.hpp"
 
 std::array<InterruptDescriptor, 256> idt;
+IrqOffStat irq_off_stat{};
 
 // 割り込みベクタの設定？
 void SetIDTEntry(InterruptDescriptor& desc,
@@ -35,10 +37,42 @@ void NotifyEndOfInterrupt(){
     *end_of_interrupt = 0;
 }
 
+// このファイルは -mgeneral-regs-only でコンパイルし，割り込み処理が XMM レジスタを触らないようにする．
+// CR0.TS が立っているときに XMM を退避しようとすると #NM になってしまうため．
+
+extern "C" void NMOnInterrupt() {
+    task_manager->SwitchFPU();
+}
+
 namespace {
+    /** @brief 割り込み処理から SSE を使うかもしれない関数（他のファイルのもの）を呼ぶ間，
+     * CR0.TS を下ろし，割り込まれた時点の FPU レジスタを退避しておく． */
+    class InterruptFPUGuard {
+        public:
+            InterruptFPUGuard() : cr0_{GetCR0()} {
+                __asm__ volatile("clts");
+                __asm__ volatile("fxsave64 %0" : "=m"(area_));
+            }
+            ~InterruptFPUGuard() {
+                __asm__ volatile("fxrstor64 %0" :: "m"(area_));
+                if (cr0_ & 8) {  // CR0.TS
+                    SetCR0(GetCR0() | 8);
+                }
+            }
+            InterruptFPUGuard(const InterruptFPUGuard&) = delete;
+            InterruptFPUGuard& operator=(const InterruptFPUGuard&) = delete;
+
+        private:
+            alignas(16) uint8_t area_[512];
+            uint64_t cr0_;
+    };
+
     __attribute__((interrupt))
     void IntHandlerXHCI(InterruptFrame* frame){
-        task_manager->SendMessage(1, Message{Message::kInterruptXHCI});
+        {
+            InterruptFPUGuard fpu_guard;
+            task_manager->SendMessage(1, Message{Message::kInterruptXHCI});
+        }
         //msg_queue->push_back(Message{Message::kInterruptXHCI});
         NotifyEndOfInterrupt();
     }
@@ -80,8 +114,11 @@ namespace {
     __attribute__((interrupt))
     void IntHandlerPF(InterruptFrame* frame, uint64_t error_code){
         uint64_t cr2 = GetCR2();
-        if(auto err = HandlePageFault(error_code, cr2); !err){
-            return;
+        {
+            InterruptFPUGuard fpu_guard;
+            if(auto err = HandlePageFault(error_code, cr2); !err){
+                return;
+            }
         }
         KillApp(frame);
         PrintFrame(frame, "#PF");
@@ -90,6 +127,17 @@ namespace {
         while(true) __asm__("hlt");
     }
 
+    /** @brief カーネルスタックがガードページまであふれると，#PF の割り込みフレームを
+     * 積めずに #DF になる．#DF は専用のスタックで受けて原因を表示する． */
+    __attribute__((interrupt))
+    void IntHandlerDF(InterruptFrame* frame, uint64_t error_code){
+        PrintFrame(frame, "#DF");
+        if(IsKernelStackGuard(frame->rsp) || IsKernelStackGuard(GetCR2())){
+            WriteString(*screen_writer, {500, 16 * 4}, "KERNEL STACK OVERFLOW", {0, 0, 0});
+        }
+        while(true) __asm__("hlt");
+    }
+
 #define FaultHandlerWithError(fault_name) \
     __attribute__((interrupt)) \
     void IntHandler ## fault_name (InterruptFrame* frame, uint64_t error_code) { \
@@ -114,8 +162,6 @@ namespace {
     FaultHandlerNoError(OF)
     FaultHandlerNoError(BR)
     FaultHandlerNoError(UD)
-    FaultHandlerNoError(NM)
-    FaultHandlerWithError(DF)
     FaultHandlerWithError(TS)
     FaultHandlerWithError(NP)
     FaultHandlerWithError(SS)
@@ -151,7 +197,10 @@ void InitializeInterrupt(){
     set_idt_entry(5,  IntHandlerBR);
     set_idt_entry(6,  IntHandlerUD);
     set_idt_entry(7,  IntHandlerNM);
-    set_idt_entry(8,  IntHandlerDF);
+    SetIDTEntry(idt[8],
+                MakeIDTAttr(DescriptorType::kInterruptGate, 0,
+                                true, kISTForDoubleFault),
+                reinterpret_cast<uint64_t>(IntHandlerDF), kKernelCS);
     set_idt_entry(10, IntHandlerTS);
     set_idt_entry(11, IntHandlerNP);
     set_idt_entry(12, IntHandlerSS);
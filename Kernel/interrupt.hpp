@@ -54,6 +54,8 @@ constexpr InterruptDescriptorAttribute MakeIDTAttr (
 }
 
 const int kISTForTimer = 1;
+/** @brief カーネルスタックがあふれたときも #DF を処理できるように別のスタックを使う． */
+const int kISTForDoubleFault = 2;
 
 void SetIDTEntry(InterruptDescriptor& desc,
                 InterruptDescriptorAttribute attr,
@@ -79,3 +81,56 @@ struct InterruptFrame {
 void NotifyEndOfInterrupt();
 
 void InitializeInterrupt();
+
+/** @brief 割り込みを禁止していた時間の統計．
+ *
+ * SaveAndDisableInterrupts で禁止してから RestoreInterrupts で許可に戻すまでを 1 区間として，
+ * TSC で測った最長の区間を記録する．DisableInterrupts から EnableInterrupts までも同じく数える．
+ * __asm__("cli") で直接禁止した区間と，途中でタスクが切り替わった区間（TaskManager が
+ * since を 0 に戻す）は数えない．割り込みを禁止する箇所は，測れるように __asm__("cli") ではなく
+ * これらの関数を使う（待つだけのアイドルタスクと例外処理は除く）．
+ */
+struct IrqOffStat {
+    /** @brief 測っている区間の開始時の TSC．0 なら測っていない． */
+    uint64_t since;
+    uint64_t max_cycles;
+    uint64_t sections;
+};
+
+extern IrqOffStat irq_off_stat;
+
+/** @brief 割り込みを禁止し，それまでの RFLAGS を返す．RestoreInterrupts と対で使う． */
+inline uint64_t SaveAndDisableInterrupts() {
+    uint64_t rflags;
+    __asm__ volatile("pushfq\n\tpop %0\n\tcli" : "=r"(rflags) :: "memory");
+    if (rflags & 0x200) {
+        irq_off_stat.since = __builtin_ia32_rdtsc();
+    }
+    return rflags;
+}
+
+/** @brief SaveAndDisableInterrupts の前に割り込みが許可されていたら許可に戻す． */
+inline void RestoreInterrupts(uint64_t rflags) {
+    if (rflags & 0x200) {
+        if (irq_off_stat.since) {
+            const uint64_t cycles = __builtin_ia32_rdtsc() - irq_off_stat.since;
+            if (cycles > irq_off_stat.max_cycles) {
+                irq_off_stat.max_cycles = cycles;
+            }
+            ++irq_off_stat.sections;
+            irq_off_stat.since = 0;
+        }
+        __asm__ volatile("sti" ::: "memory");
+    }
+}
+
+/** @brief 割り込みを禁止する．EnableInterrupts と対で使う．
+ * 禁止したまま眠るなど，RFLAGS を持ち回れない箇所で __asm__("cli") の代わりに使う． */
+inline void DisableInterrupts() {
+    SaveAndDisableInterrupts();
+}
+
+/** @brief 割り込みを許可する．DisableInterrupts から測っていた区間を閉じる． */
+inline void EnableInterrupts() {
+    RestoreInterrupts(0x200);
+}
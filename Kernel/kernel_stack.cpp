@@ -0,0 +1,96 @@
+#include "kernel_stack.hpp"
+
+#include "interrupt.hpp"
+#include "logger.hpp"
+#include "memory_manager.hpp"
+#include "paging.hpp"
+
+namespace {
+    const uint64_t kPageBytes = 4096;
+    const size_t kStackPages = kKernelStackBytes / kPageBytes;
+    /** @brief ガードページ 1 枚とスタック 1 つの組の大きさ． */
+    const uint64_t kSlotBytes = kKernelStackBytes + kPageBytes;
+    const size_t kInitialKernelStacks = 16;
+
+    /** @brief 空きスタックの連結リストの先頭（スタックの終端アドレス）．
+     * 次の空きスタックの終端アドレスは，各空きスタックの最上位の 8 バイトに書いておく． */
+    uint64_t free_head = 0;
+    /** @brief 物理メモリを割り当て済みのスタックの数． */
+    size_t num_mapped = 0;
+
+    uint64_t& NextFree(uint64_t stack_end) {
+        return *reinterpret_cast<uint64_t*>(stack_end - sizeof(uint64_t));
+    }
+
+    /** @brief slot 番目のスタックに物理メモリを割り当ててマップする．ガードページはマップしない． */
+    WithError<uint64_t> MapSlot(size_t slot) {
+        auto [frame, err] = memory_manager->Allocate(kStackPages);
+        if (err) {
+            return {0, err};
+        }
+
+        const uint64_t stack_begin = kKernelStackBase + slot * kSlotBytes + kPageBytes;
+        const auto phys = reinterpret_cast<uint64_t>(frame.Frame());
+        for (size_t i = 0; i < kStackPages; ++i) {
+            const LinearAddress4Level addr{stack_begin + i * kPageBytes};
+            if (auto err = MapKernelPage(addr, phys + i * kPageBytes)) {
+                // 途中まで作った対応付けを消してから物理メモリを返す．途中で作ったページテーブルは
+                // 次にこのスロットをマップするときに使うので残しておく
+                for (size_t j = 0; j < i; ++j) {
+                    UnmapKernelPage(LinearAddress4Level{stack_begin + j * kPageBytes});
+                }
+                memory_manager->Free(frame, kStackPages);
+                return {0, err};
+            }
+        }
+        return {stack_begin + kKernelStackBytes, MAKE_ERROR(Error::kSuccess)};
+    }
+}
+
+void InitializeKernelStacks() {
+    for (size_t i = 0; i < kInitialKernelStacks; ++i) {
+        auto [stack_end, err] = MapSlot(num_mapped);
+        if (err) {
+            Log(kError, "failed to map kernel stack: %s\n", err.Name());
+            return;
+        }
+        ++num_mapped;
+        FreeKernelStack(stack_end);
+    }
+}
+
+WithError<uint64_t> AllocateKernelStack() {
+    const auto rflags = SaveAndDisableInterrupts();
+    if (free_head != 0) {
+        const uint64_t stack_end = free_head;
+        free_head = NextFree(stack_end);
+        RestoreInterrupts(rflags);
+        return {stack_end, MAKE_ERROR(Error::kSuccess)};
+    }
+
+    if (num_mapped >= kMaxKernelStacks) {
+        RestoreInterrupts(rflags);
+        return {0, MAKE_ERROR(Error::kFull)};
+    }
+    auto result = MapSlot(num_mapped);
+    if (!result.error) {
+        ++num_mapped;
+    }
+    RestoreInterrupts(rflags);
+    return result;
+}
+
+void FreeKernelStack(uint64_t stack_end) {
+    const auto rflags = SaveAndDisableInterrupts();
+    NextFree(stack_end) = free_head;
+    free_head = stack_end;
+    RestoreInterrupts(rflags);
+}
+
+bool IsKernelStackGuard(uint64_t addr) {
+    if (addr < kKernelStackBase ||
+        kKernelStackBase + kMaxKernelStacks * kSlotBytes <= addr) {
+        return false;
+    }
+    return (addr - kKernelStackBase) % kSlotBytes < kPageBytes;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file kernel_stack.hpp
+ *
+ * タスクのカーネルスタックを専用の仮想アドレス範囲から払い出すプール．
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+
+/** @brief カーネルスタック 1 つの大きさ（ガードページを除く）． */
+const size_t kKernelStackBytes = 8 * 4096;
+
+/** @brief カーネルスタックを置く仮想アドレス範囲の先頭．PML4 の 254 番目のエントリ．
+ *
+ * 範囲は kKernelStackBytes のスタックとその直下のマップしないガードページを
+ * 1 組として並べる．スタックがあふれるとガードページでページフォルトが起きる．
+ * この範囲の PML4 エントリは起動時に作っておくので，アプリの PML4 にも引き継がれる．
+ */
+const uint64_t kKernelStackBase = 0x0000'7f00'0000'0000;
+/** @brief プールから払い出せるスタックの最大数． */
+const size_t kMaxKernelStacks = 4096;
+
+/** @brief 最初のいくつかのスタックをマップしておく．InitializeTask の前に呼ぶ． */
+void InitializeKernelStacks();
+
+/** @brief スタックを 1 つ取り出す．
+ *
+ * 返されたスタックの中身は不定（前に使っていたタスクの値が残っている）．
+ * 空きが無ければ新しいスタックに物理メモリを割り当ててマップする．
+ * @return スタックの終端（最初に push する位置の 1 つ上）のアドレス
+ */
+WithError<uint64_t> AllocateKernelStack();
+
+/** @brief AllocateKernelStack で得たスタックをプールに返す．
+ *
+ * 物理メモリはマップしたまま次の AllocateKernelStack で使い回す．
+ * 返したスタックの上で走り続けてよいのは，割り込みを禁止したまま
+ * 他のタスクに切り替えるまでの間だけ．
+ */
+void FreeKernelStack(uint64_t stack_end);
+
+/** @brief addr がカーネルスタックのガードページの中なら true． */
+bool IsKernelStackGuard(uint64_t addr);
@@ -1,7 +1,9 @@
 #include "layer.hpp"
 
 #include <algorithm>
+#include <limits>
 #include "console.hpp"
+#include "interrupt.hpp"
 #include "logger.hpp"
 #include "task.hpp"
 namespace {
@@ -71,44 +73,213 @@ Layer& LayerManager::NewLayer(){
     return * layers_.emplace_back(new Layer{latest_id_});
 }
 
-void LayerManager::Draw(const Rectangle<int>& area) const {
-    for(auto layer : layer_stack_) {
-        layer->DrawTo(back_buffer_, area);
+void LayerManager::AddDamage(const Rectangle<int>& area) {
+    const Rectangle<int> screen_area{{0, 0}, ScreenSize()};
+    const auto clipped = area & screen_area;
+    if (!IsEmpty(clipped)) {
+        // 他のタスクからも呼ばれるので，Flush と重ならないように割り込みを禁止する
+        const auto rflags = SaveAndDisableInterrupts();
+        damage_.Add(clipped);
+        RestoreInterrupts(rflags);
     }
-    screen_->Copy(area.pos, back_buffer_, area);
 }
 
-void LayerManager::Draw(unsigned int id) const {
-    Draw(id, {{0,0}, {-1, -1}});
+void LayerManager::AddDamage(unsigned int id, Rectangle<int> area) {
+    const bool whole = area.size.x < 0 && area.size.y < 0;
+    const auto rflags = SaveAndDisableInterrupts();
+    // 1 レイヤ 1 要素にまとめ，描画の多いアプリでも 1 フレームの記録が増え続けないようにする
+    auto it = std::find_if(layer_damage_.begin(), layer_damage_.end(),
+                           [id](const auto& d) { return d.first == id; });
+    if (it == layer_damage_.end()) {
+        layer_damage_.emplace_back(id, area);
+    } else if (whole || (it->second.size.x < 0 && it->second.size.y < 0)) {
+        it->second = {{0, 0}, {-1, -1}};
+    } else {
+        const auto pos = ElementMin(it->second.pos, area.pos);
+        const auto end = ElementMax(it->second.pos + it->second.size, area.pos + area.size);
+        it->second = {pos, end - pos};
+    }
+    RestoreInterrupts(rflags);
 }
 
-void LayerManager::Draw(unsigned int id, Rectangle<int> area) const {
-    bool draw = false;
-    Rectangle<int> window_area;
-    for(auto layer : layer_stack_) {
-        if (layer->ID() == id) {
-            window_area.size = layer->GetWindow()->Size();
-            window_area.pos = layer->GetPosition();
-         if(area.size.x >= 0 || area.size.y >= 0){
+uint64_t LayerManager::Flush() {
+    Region damage;
+    std::vector<std::pair<unsigned int, Rectangle<int>>> layer_damage;
+    const auto rflags = SaveAndDisableInterrupts();
+    std::swap(damage, damage_);
+    std::swap(layer_damage, layer_damage_);
+    RestoreInterrupts(rflags);
+
+    // レイヤ内の座標で記録されたダメージを画面上の位置に直す．隠れているレイヤの分は捨てる
+    const Rectangle<int> screen_area{{0, 0}, ScreenSize()};
+    for (auto [id, area] : layer_damage) {
+        auto it = std::find_if(layer_stack_.begin(), layer_stack_.end(),
+                               [id = id](Layer* layer) { return layer->ID() == id; });
+        if (it == layer_stack_.end() || !(*it)->GetWindow()) {
+            continue;
+        }
+
+        Rectangle<int> window_area{(*it)->GetPosition(), (*it)->GetWindow()->Size()};
+        if (area.size.x >= 0 || area.size.y >= 0) {
             area.pos = area.pos + window_area.pos;
             window_area = window_area & area;
         }
-        draw = true;
+        const auto clipped = window_area & screen_area;
+        if (!IsEmpty(clipped)) {
+            damage.Add(clipped);
+        }
+    }
+
+    if (damage.Empty()) {
+        return 0;
+    }
+    Composite(damage);
+    return damage.Area();
+}
+
+/** ダメージを上のレイヤから順に見ていき，各レイヤで実際に見えている部分を求める．
+ * 不透明なレイヤの下は描いても上書きされるだけなので，そこで領域を削って下へ進む．
+ * その後，見えている部分だけを下のレイヤから順に描く（透過色を持つレイヤの下も描く必要があるため）．
+ */
+void LayerManager::Composite(const Region& damage) {
+    Region remaining = damage;
+    visible_.clear();
+    for (auto it = layer_stack_.rbegin(); it != layer_stack_.rend(); ++it) {
+        if (remaining.Empty()) {
+            break;
+        }
+        const Layer* layer = *it;
+        const auto window = layer->GetWindow();
+        if (!window) {
+            continue;
+        }
+
+        const Rectangle<int> layer_area{layer->GetPosition(), window->Size()};
+        auto fragments = remaining.Intersect(layer_area);
+        if (fragments.Empty()) {
+            continue;
+        }
+        if (window->IsOpaque()) {
+            remaining.Subtract(layer_area);
         }
-        if(draw) {
-            layer->DrawTo(back_buffer_, window_area);
+        visible_.emplace_back(layer, std::move(fragments));
+    }
+
+    for (auto it = visible_.rbegin(); it != visible_.rend(); ++it) {
+        for (const auto& rect : it->second.Rects()) {
+            it->first->DrawTo(back_buffer_, rect);
         }
     }
-    screen_->Copy(window_area.pos, back_buffer_, window_area);
+    // カーソルの範囲は裏画面にカーソルを重ねてから写すので，ここでは除く
+    const auto cursor_area = CursorArea();
+    bool cursor_damaged = false;
+    for (const auto& rect : damage.Rects()) {
+        Region to_screen{};
+        to_screen.Add(rect);
+        if (!IsEmpty(cursor_area)) {
+            to_screen.Subtract(cursor_area);
+            cursor_damaged |= to_screen.Area() != rect.size.x * static_cast<uint64_t>(rect.size.y);
+        }
+        for (const auto& r : to_screen.Rects()) {
+            screen_->Copy(r.pos, back_buffer_, r);
+        }
+    }
+    if (cursor_damaged) {
+        ComposeCursor(cursor_area);
+    }
+}
+
+Rectangle<int> LayerManager::CursorArea() const {
+    if (!cursor_) {
+        return {{0, 0}, {0, 0}};
+    }
+    const Rectangle<int> screen_area{{0, 0}, ScreenSize()};
+    return Rectangle<int>{cursor_pos_, cursor_->Size()} & screen_area;
+}
+
+void LayerManager::ComposeCursor(const Rectangle<int>& area) {
+    if (IsEmpty(area)) {
+        return;
+    }
+    // 画面に直接カーソルを描くと，一瞬カーソルの消えた画素が見えることがあるので作業用の画面で組み立てる
+    const Rectangle<int> scratch_area{{0, 0}, area.size};
+    cursor_scratch_.Copy({0, 0}, back_buffer_, area);
+    cursor_->DrawTo(cursor_scratch_, cursor_pos_ - area.pos, scratch_area);
+    screen_->Copy(area.pos, cursor_scratch_, scratch_area);
+}
+
+void LayerManager::SetCursor(const std::shared_ptr<Window>& image, Vector2D<int> pos) {
+    const auto old_area = CursorArea();
+    cursor_ = image;
+    cursor_pos_ = pos;
+
+    FrameBufferConfig config = screen_->Config();
+    config.frame_buffer = nullptr;
+    config.horizontal_resolution = image->Width() * 2;
+    config.vertical_resolution = image->Height() * 2;
+    if (auto err = cursor_scratch_.Initialize(config)) {
+        Log(kError, "failed to initialize cursor buffer: %s\n", err.Name());
+        cursor_.reset();
+        return;
+    }
+
+    if (!IsEmpty(old_area)) {
+        screen_->Copy(old_area.pos, back_buffer_, old_area);
+    }
+    ComposeCursor(CursorArea());
+}
+
+void LayerManager::MoveCursor(Vector2D<int> pos) {
+    if (!cursor_ || (pos.x == cursor_pos_.x && pos.y == cursor_pos_.y)) {
+        return;
+    }
+
+    const auto old_area = CursorArea();
+    cursor_pos_ = pos;
+    const auto new_area = CursorArea();
+
+    const auto overlap = old_area & new_area;
+    if (IsEmpty(overlap)) {
+        // 離れていれば，元の位置を裏画面から戻して新しい位置に描くだけ
+        screen_->Copy(old_area.pos, back_buffer_, old_area);
+        ComposeCursor(new_area);
+        return;
+    }
+
+    // 重なっていれば両方を囲む範囲（カーソルの縦横 2 倍未満）をまとめて組み立てる
+    const auto pos0 = ElementMin(old_area.pos, new_area.pos);
+    const auto end = ElementMax(old_area.pos + old_area.size, new_area.pos + new_area.size);
+    ComposeCursor({pos0, end - pos0});
+}
+
+void LayerManager::Draw(const Rectangle<int>& area) {
+    AddDamage(area);
+    if (!deferred_) {
+        Flush();
+    }
+}
+
+void LayerManager::Draw(unsigned int id) {
+    Draw(id, {{0,0}, {-1, -1}});
+}
+
+void LayerManager::Draw(unsigned int id, Rectangle<int> area) {
+    AddDamage(id, area);
+    if (!deferred_) {
+        Flush();
+    }
 }
 
 void LayerManager::Move(unsigned int id, Vector2D<int> new_pos) {
     auto layer = FindLayer(id);
     const auto window_size = layer->GetWindow()->Size();
     const auto old_pos = layer->GetPosition();
-  layer->Move(new_pos);
-    Draw({old_pos, window_size});
-    Draw(id);
+    layer->Move(new_pos);
+    AddDamage({old_pos, window_size});
+    AddDamage({new_pos, window_size});
+    if (!deferred_) {
+        Flush();
+    }
 }
 
 void LayerManager::MoveRelative(unsigned int id, Vector2D<int> pos_diff){
@@ -116,8 +287,11 @@ void LayerManager::MoveRelative(unsigned int id, Vector2D<int> pos_diff){
     const auto window_size = layer->GetWindow()->Size();
     const auto old_pos = layer->GetPosition();
     layer->MoveRelative(pos_diff);
-    Draw({old_pos, window_size});
-    Draw(id);
+    AddDamage({old_pos, window_size});
+    AddDamage({layer->GetPosition(), window_size});
+    if (!deferred_) {
+        Flush();
+    }
 }
 
 void LayerManager::UpDown(unsigned int id, int new_height){
@@ -224,10 +398,6 @@ ActiveLayer::ActiveLayer(LayerManager& manager) : manager_{manager} {
 
 }
 
-void ActiveLayer::SetMouseLayer(unsigned int mouse_layer){
-    mouse_layer_ = mouse_layer;
-}
-
 void ActiveLayer::Activate(unsigned int layer_id){
     if (active_layer_ == layer_id){
         return;
@@ -245,7 +415,7 @@ void ActiveLayer::Activate(unsigned int layer_id){
         Layer* layer = manager_.FindLayer(active_layer_);
         layer->GetWindow()->Activate();
         manager_.UpDown(active_layer_, 0);
-        manager_.UpDown(active_layer_, manager_.GetHeight(mouse_layer_) - 1);
+        manager_.UpDown(active_layer_, std::numeric_limits<int>::max());
         manager_.Draw(active_layer_);
         SendWindowActiveMessage(active_layer_, 1);
     }
@@ -295,6 +465,7 @@ void InitializeLayer() {
 
 void ProcessLayerMessage(const Message& msg) {
     const auto& arg = msg.arg.layer;
+    LockGuard lock{layer_manager->GetLock()};
 
     switch(arg.op){
         case LayerOperation::Move:
@@ -313,6 +484,7 @@ void ProcessLayerMessage(const Message& msg) {
 }
 
 Error CloseLayer(unsigned int layer_id){
+    LockGuard lock{layer_manager->GetLock()};
 
     Layer* layer = layer_manager->FindLayer(layer_id);
     if(layer == nullptr){
@@ -322,12 +494,12 @@ Error CloseLayer(unsigned int layer_id){
     const auto pos = layer->GetPosition();
     const auto size = layer->GetWindow()->Size();
 
-    __asm__("cli");
     active_layer->Activate(0);
     layer_manager->RemoveLayer(layer_id);
     layer_manager->Draw({pos, size});
+    const auto rflags = SaveAndDisableInterrupts();
     layer_task_map->erase(layer_id);
-    __asm__("sti");
+    RestoreInterrupts(rflags);
 
     return MAKE_ERROR(Error::kSuccess);
 }
\ No newline at end of file
@@ -7,6 +7,8 @@
 #include "graphics.hpp"
 #include "window.hpp"
 #include "message.hpp"
+#include "region.hpp"
+#include "wait_queue.hpp"
 
 
 class Layer {
@@ -37,9 +39,37 @@ class LayerManager {
         void SetWriter(FrameBuffer* screen);
         Layer& NewLayer();
 
-        void Draw(const Rectangle<int>& area) const;
-        void Draw(unsigned int id) const;
-        void Draw(unsigned int id, Rectangle<int> area) const;
+        /** @brief 画面上の area を再描画が必要な領域（ダメージ）に加える． */
+        void AddDamage(const Rectangle<int>& area);
+        /** @brief id のレイヤの area（レイヤ内の座標，大きさが負ならレイヤ全体）をダメージに加える．
+         *
+         * レイヤの並びには触らず記録するだけなので，ロックを取らずにどのタスクからも呼べる．
+         * 画面上の位置は Flush のときに求める．
+         */
+        void AddDamage(unsigned int id, Rectangle<int> area = {{0, 0}, {-1, -1}});
+        /** @brief 溜まったダメージを 1 回で描き直して画面に写し，その画素数を返す．
+         * SetDeferred(true) の後は GetLock() のロックを取って呼ぶこと． */
+        uint64_t Flush();
+        /** @brief レイヤの並び（追加・削除・移動・上下関係）と合成を守るロック．
+         * 割り込みを禁止する代わりにこれを取るので，合成中もタイマや他のタスクは止まらない． */
+        Mutex& GetLock() { return lock_; }
+        /** @brief true にすると Draw, Move はダメージを記録するだけになり，
+         * 画面への反映は Flush（Compositor のフレーム）まで遅れる． */
+        void SetDeferred(bool deferred) { deferred_ = deferred; }
+
+        /** @brief マウスカーソルの画像を設定して pos に表示する．
+         *
+         * カーソルはレイヤではなく，合成の最後に画面（表画面）へ直接重ねる．
+         * image は透過色を持つウィンドウ．
+         */
+        void SetCursor(const std::shared_ptr<Window>& image, Vector2D<int> pos);
+        /** @brief カーソルを pos に動かす．下の画素は裏画面から戻すので，
+         * レイヤを合成し直さずカーソルの面積に比例した時間で済む．GetLock() を取って呼ぶこと． */
+        void MoveCursor(Vector2D<int> pos);
+
+        void Draw(const Rectangle<int>& area);
+        void Draw(unsigned int id);
+        void Draw(unsigned int id, Rectangle<int> area);
         void Move(unsigned int id, Vector2D<int> new_pos);
         void MoveRelative(unsigned int id, Vector2D<int> pos_diff);
         void UpDown(unsigned int id, int new_height);
@@ -50,10 +80,30 @@ class LayerManager {
         void RemoveLayer(unsigned int id);
     private:
         FrameBuffer* screen_{nullptr};
-        mutable FrameBuffer back_buffer_{};
+        FrameBuffer back_buffer_{};
         std::vector<std::unique_ptr<Layer>> layers_{};
         std::vector<Layer*> layer_stack_{};
         unsigned int latest_id_{0};
+
+        /** @brief まだ画面に反映していない領域． */
+        Region damage_{};
+        /** @brief AddDamage(id, area) で記録した，まだ画面上の位置に直していないダメージ． */
+        std::vector<std::pair<unsigned int, Rectangle<int>>> layer_damage_{};
+        bool deferred_{false};
+        Mutex lock_{};
+        /** @brief Composite で使う，レイヤと見えている部分の組．確保を使い回すために持つ． */
+        std::vector<std::pair<const Layer*, Region>> visible_{};
+
+        std::shared_ptr<Window> cursor_{};
+        Vector2D<int> cursor_pos_{};
+        /** @brief カーソルを重ねた画素を組み立てる作業用の画面．カーソルの縦横 2 倍の大きさ． */
+        FrameBuffer cursor_scratch_{};
+
+        void Composite(const Region& damage);
+        /** @brief 画面上のカーソルの範囲（画面の外にはみ出す部分を除く）．カーソルがなければ空． */
+        Rectangle<int> CursorArea() const;
+        /** @brief 画面の area を，裏画面の内容にカーソルを重ねたもので書き換える． */
+        void ComposeCursor(const Rectangle<int>& area);
 };
 
 extern LayerManager* layer_manager;
@@ -62,13 +112,11 @@ extern LayerManager* layer_manager;
 class ActiveLayer {
     public:
         ActiveLayer(LayerManager& manager);
-        void SetMouseLayer(unsigned int mouse_layer);
         void Activate(unsigned int layer_id);
         unsigned int GetActive() const { return active_layer_; }
     private:
         LayerManager& manager_;
         unsigned int active_layer_{0};
-        unsigned int mouse_layer_{0};
 };
 
 extern ActiveLayer* active_layer;
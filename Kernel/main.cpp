@@ -41,6 +41,12 @@
 #include "terminal.hpp"
 #include "fat.hpp"
 #include "syscall.hpp"
+#include "fpu.hpp"
+#include "boot_option.hpp"
+#include "idle.hpp"
+#include "kernel_stack.hpp"
+#include "pixel_ops.hpp"
+#include "compositor.hpp"
 
 int printk(const char* format, ...) {
     va_list ap;
@@ -142,6 +148,7 @@ extern "C" void KernelMainNewStack(
     InitializeTSS();
     InitializeInterrupt();
     fat::Initialize(volume_image);
+    LoadBootOptions();
     InitializeFont();
     InitializePCI();
 
@@ -160,46 +167,43 @@ extern "C" void KernelMainNewStack(
 
     InitializeSyscall();
     
+    InitializeFPU();
+    InitializePixelOps();
+    InitializeIdle();
+    InitializeKernelStacks();
     InitializeTask();
     Task& main_task = task_manager->CurrentTask();
 
     usb::xhci::Initialize();
     InitializeKeyboard();
     InitializeMouse();
+    InitializeCompositor();
 
-    task_manager->NewTask()
-        .InitContext(TaskTerminal, 0)
-        .Wakeup();
+    if(auto [term_task, err] = task_manager->NewTask(); err){
+        Log(kError, "failed to create a terminal: %s\n", err.Name());
+    } else {
+        term_task->InitContext(TaskTerminal, 0).Wakeup();
+    }
 
     char str[128];
 
     // ==============================================================================
     // 割り込みで受け取ったメッセージを処理する
     while (true){
-
-        __asm__("cli");
-        const auto tick = timer_manager->CurrentTick();
-        __asm__("sti");
-
-        sprintf(str, "%010lu", tick);
-        FillRectangle(*main_window->InnerWriter(), {20, 4}, {8 * 10, 16}, {0xc6, 0xc6, 0xc6});
-        WriteString(*main_window->InnerWriter(), {20, 4}, str, {0, 0, 0});
-        layer_manager->Draw(main_window_layer_id);
-
         // 今からメッセージキューからメッセージを取り出す。
         // その間に割り込みが起きてメッセージが追加されると困るので、
         // cli命令を実行して割り込み許可フラグをゼロにする。
-        __asm__("cli");
+        DisableInterrupts();
         auto msg = main_task.ReceiveMessage();
         if(!msg){
             main_task.Sleep();
-            __asm__("sti");
+            EnableInterrupts();
             continue;
         }
 
         // Message msg = main_queue->front();
         // main_queue->pop_front();
-        __asm__("sti");
+        EnableInterrupts();
         // メッセージの取得が完了したらsti命令で割り込み許可フラグを戻す。
 
         switch(msg->type){
@@ -207,11 +211,22 @@ extern "C" void KernelMainNewStack(
                 usb::xhci::ProcessEvents();
                 break;
             case Message::kTimerTimeout:
-                if(msg->arg.timer.value == kTextboxCursorTimer){
-                    __asm__("cli");
+                if(msg->arg.timer.value == kCompositorTimer){
+                    // カウンタの表示はフレームごとに 1 回だけ更新する
+                    const auto rflags = SaveAndDisableInterrupts();
+                    const auto tick = timer_manager->CurrentTick();
+                    RestoreInterrupts(rflags);
+
+                    sprintf(str, "%010lu", tick);
+                    FillRectangle(*main_window->InnerWriter(), {20, 4}, {8 * 10, 16}, {0xc6, 0xc6, 0xc6});
+                    WriteString(*main_window->InnerWriter(), {20, 4}, str, {0, 0, 0});
+                    layer_manager->Draw(main_window_layer_id);
+                    compositor->Frame();
+                } else if(msg->arg.timer.value == kTextboxCursorTimer){
+                    DisableInterrupts();
                     timer_manager->AddTimer(
                         Timer{msg->arg.timer.timeout + kTimer05Sec, kTextboxCursorTimer, 1});
-                    __asm__("sti");
+                    EnableInterrupts();
                     textbox_cursor_visible = !textbox_cursor_visible;
                     DrawTextCursor(textbox_cursor_visible);
                     layer_manager->Draw(text_window_layer_id);
@@ -224,17 +239,19 @@ extern "C" void KernelMainNewStack(
                     }
                 } else if (msg->arg.keyboard.press &&
                             msg->arg.keyboard.keycode == 59 /* F2 */){
-                    task_manager->NewTask()
-                        .InitContext(TaskTerminal, 0)
-                        .Wakeup();
+                    if(auto [term_task, err] = task_manager->NewTask(); err){
+                        Log(kError, "failed to create a terminal: %s\n", err.Name());
+                    } else {
+                        term_task->InitContext(TaskTerminal, 0).Wakeup();
+                    }
                 } else {
-                    __asm__("cli");
+                    DisableInterrupts();
                     auto task_it = layer_task_map->find(act);
-                    __asm__("sti");
+                    EnableInterrupts();
                     if(task_it != layer_task_map->end()){
-                        __asm__("cli");
+                        DisableInterrupts();
                         task_manager->SendMessage(task_it->second, *msg);
-                        __asm__("sti");
+                        EnableInterrupts();
                     } else {
                         printk("key push not handled: keycode %02x, ascii %02x\n",
                             msg->arg.keyboard.keycode,
@@ -243,10 +260,9 @@ extern "C" void KernelMainNewStack(
                 }                
                 break;
             case Message::kLayer:
+                // 画面に反映されるのは次のフレームなので，kLayerFinish はその後に送る
                 ProcessLayerMessage(*msg);
-                __asm__("cli");
-                task_manager->SendMessage(msg->src_task, Message{Message::kLayerFinish});
-                __asm__("sti");
+                compositor->NotifyAfterFrame(msg->src_task);
                 break;
             default:
                 Log(kError, "Unknown message type: %d\n", msg->type);
@@ -107,30 +107,29 @@ void SendCloseMessage() {
 }
 
 void DrawMouseCursor(PixelWriter* pixel_writer, Vector2D<int> position) {
+    PixelColor row[kMouseCursorWidth];
     for(int dy = 0; dy < kMouseCursorHeight; ++dy){
         for(int dx = 0; dx < kMouseCursorWidth; ++dx){
             if(mouse_cursor_shape[dy][dx] == '@'){
-                pixel_writer->Write(position + Vector2D<int>{dx, dy}, {0, 0, 0});
+                row[dx] = {0, 0, 0};
             } else if(mouse_cursor_shape[dy][dx] == '.'){
-                pixel_writer->Write(position + Vector2D<int>{dx, dy}, {255, 255, 255});
+                row[dx] = {255, 255, 255};
             } else {
-                pixel_writer->Write(position + Vector2D<int>{dx, dy}, kMouseTransparentColor);
+                row[dx] = kMouseTransparentColor;
             }
         }
+        pixel_writer->WriteRow(position + Vector2D<int>{0, dy}, row, kMouseCursorWidth);
     }
 }
 
 
-Mouse::Mouse(unsigned int layer_id) : layer_id_{layer_id}{    
-
-}
-
 void Mouse::SetPosition(Vector2D<int> position){
     position_ = position;
-    layer_manager->Move(layer_id_, position_);
+    layer_manager->MoveCursor(position_);
 }
 
 void Mouse::OnInterrupt(uint8_t buttons, int8_t displacement_x, int8_t displacement_y){
+    LockGuard lock{layer_manager->GetLock()};
     const auto oldpos = position_;
     auto newpos = position_ + Vector2D<int>{displacement_x, displacement_y};
     newpos = ElementMin(newpos, ScreenSize() + Vector2D<int>{-1, -1});
@@ -138,14 +137,14 @@ void Mouse::OnInterrupt(uint8_t buttons, int8_t displacement_x, int8_t displacem
 
     const auto posdiff = position_ - oldpos;
 
-    layer_manager->Move(layer_id_, position_);
+    layer_manager->MoveCursor(position_);
 
     unsigned int close_layer_id = 0;
 
     const bool previous_left_pressed = (previous_buttons_ & 0x01);
     const bool left_pressed = (buttons & 0x01);
     if(!previous_left_pressed && left_pressed) {
-        auto layer = layer_manager->FindLayerByPosition(position_, layer_id_);
+        auto layer = layer_manager->FindLayerByPosition(position_, 0);
         if(layer && layer->IsDraggable()){
             const auto pos_layer = position_ - layer->GetPosition();
             switch(layer->GetWindow()->GetWindowRegion(pos_layer)){
@@ -188,18 +187,14 @@ void InitializeMouse(){
     mouse_window->SetTransparentColor(kMouseTransparentColor);
     DrawMouseCursor(mouse_window->Writer(), {0, 0});
 
-    auto mouse_layer_id = layer_manager->NewLayer()
-        .SetWindow(mouse_window)
-        .ID();
-    
-    auto mouse = std::make_shared<Mouse>(mouse_layer_id);
+    // カーソルはレイヤにせず，合成の最後に画面へ直接重ねる
+    layer_manager->SetCursor(mouse_window, {200, 200});
+
+    auto mouse = std::make_shared<Mouse>();
     mouse->SetPosition({200, 200});
-    layer_manager->UpDown(mouse->LayerID(), std::numeric_limits<int>::max());
 
     usb::HIDMouseDriver::default_observer = 
         [mouse](uint8_t buttons, int8_t displacement_x, int8_t displacement_y) {
             mouse->OnInterrupt(buttons, displacement_x, displacement_y);
         };
-
-    active_layer->SetMouseLayer(mouse_layer_id);
 }
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 
+static constexpr uint32_t kIA32_TSC_DEADLINE = 0x000006e0;
 static constexpr uint32_t kIA32_EFER    = 0xc0000080;
 static constexpr uint32_t kIA32_STAR    = 0xc0000081;
 static constexpr uint32_t kIA32_LSTAR    = 0xc0000082;
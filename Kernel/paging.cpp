@@ -4,6 +4,7 @@
 #include <cstring>
 
 #include "asmfunc.h"
+#include "clock_page.hpp"
 #include "memory_manager.hpp"
 #include "task.hpp"
 
@@ -109,7 +110,7 @@ namespace{
                 }
             }
 
-            if(entry.bits.writable){
+            if(entry.bits.writable && !entry.bits.shared){
                 const auto entry_addr = reinterpret_cast<uintptr_t>(entry.Pointer());
                 const FrameID map_frame{entry_addr / kBytesPerFrame};
                 if(auto err = memory_manager->Free(map_frame, 1)){
@@ -171,6 +172,35 @@ namespace{
         return SetPageContent(reinterpret_cast<PageMapEntry*>(GetCR3()), 4,
                               LinearAddress4Level{causal_addr}, p);
     }
+
+    /** @brief pml4 のページテーブルで addr の 4KiB ページを phys_addr に対応付ける．
+     * user が false ならアプリからは触れないページにする． */
+    Error MapPage(PageMapEntry* pml4, LinearAddress4Level addr, uint64_t phys_addr,
+                  bool user, bool writable, bool shared = false){
+        auto page_map = pml4;
+        for(int level = 4; level > 1; --level){
+            auto& entry = page_map[addr.Part(level)];
+            auto [child_map, err] = SetNewPageMapIfNotPresent(entry);
+            if(err){
+                return err;
+            }
+            if(user){
+                entry.bits.user = 1;
+            }
+            entry.bits.writable = 1;
+            page_map = child_map;
+        }
+
+        auto& entry = page_map[addr.Part(1)];
+        entry.data = 0;
+        entry.SetPointer(reinterpret_cast<PageMapEntry*>(phys_addr));
+        entry.bits.present = 1;
+        entry.bits.user = user;
+        entry.bits.writable = writable;
+        entry.bits.shared = shared;
+        InvalidateTLB(addr.value);
+        return MAKE_ERROR(Error::kSuccess);
+    }
 } //namespace
 
 WithError<PageMapEntry*> NewPageMap(){
@@ -199,6 +229,35 @@ Error CleanPageMaps(LinearAddress4Level addr){
     return CleanPageMap(pml4_table, 4, addr);
 }
 
+Error CleanPageMaps(PageMapEntry* pml4, LinearAddress4Level addr){
+    return CleanPageMap(pml4, 4, addr);
+}
+
+Error MapPhysicalPage(LinearAddress4Level addr, uint64_t phys_addr, bool writable){
+    return MapPage(reinterpret_cast<PageMapEntry*>(GetCR3()), addr, phys_addr, true, writable);
+}
+
+Error MapSharedPage(LinearAddress4Level addr, uint64_t phys_addr){
+    return MapPage(reinterpret_cast<PageMapEntry*>(GetCR3()), addr, phys_addr, true, true, true);
+}
+
+Error MapKernelPage(LinearAddress4Level addr, uint64_t phys_addr){
+    return MapPage(reinterpret_cast<PageMapEntry*>(&pml4_table[0]), addr, phys_addr, false, true);
+}
+
+void UnmapKernelPage(LinearAddress4Level addr){
+    auto page_map = reinterpret_cast<PageMapEntry*>(&pml4_table[0]);
+    for(int level = 4; level > 1; --level){
+        const auto& entry = page_map[addr.Part(level)];
+        if(!entry.bits.present){
+            return;
+        }
+        page_map = entry.Pointer();
+    }
+    page_map[addr.Part(1)].data = 0;
+    InvalidateTLB(addr.value);
+}
+
 Error CopyPageMaps(PageMapEntry* dest, PageMapEntry* src, int part, int start){
     if (part == 1){
         for(int i = start; i < 512; ++i){
@@ -215,6 +274,14 @@ Error CopyPageMaps(PageMapEntry* dest, PageMapEntry* src, int part, int start){
         if(!src[i].bits.present){
             continue;
         }
+        if(dest[i].bits.present){
+            // SetupPML4 で作った時計ページ用のテーブルなど，既にあるものは使い回す
+            if(auto err = CopyPageMaps(dest[i].Pointer(), src[i].Pointer(), part - 1, 0)){
+                return err;
+            }
+            continue;
+        }
+
         auto [table, err] = NewPageMap();
         if(err){
             return err;
@@ -235,6 +302,9 @@ Error HandlePageFault(uint64_t error_code, uint64_t causal_addr){
     const bool user     = (error_code >> 2) & 1;
     
     if(present && rw && user){
+        if((causal_addr & 0xffff'ffff'ffff'f000) == CLOCK_PAGE_ADDR){
+            return MAKE_ERROR(Error::kAlreadyAllocated);
+        }
         return CopyOnePage(causal_addr);
     } else if(present){
         return MAKE_ERROR(Error::kAlreadyAllocated);
@@ -249,4 +319,28 @@ Error HandlePageFault(uint64_t error_code, uint64_t causal_addr){
     }
 
     return MAKE_ERROR(Error::kIndexOutOfRange);
-}
\ No newline at end of file
+}
+
+WithError<uint64_t> LinearToPhysical(uint64_t vaddr, bool* writable){
+    const LinearAddress4Level addr{vaddr};
+    auto table = reinterpret_cast<PageMapEntry*>(GetCR3());
+    if(writable){
+        *writable = true;
+    }
+    for(int level = 4; level >= 1; --level){
+        const auto entry = table[addr.Part(level)];
+        if(!entry.bits.present){
+            return {0, MAKE_ERROR(Error::kNoSuchEntry)};
+        }
+        if(writable && !entry.bits.writable){
+            *writable = false;
+        }
+        if(level == 1 || entry.bits.huge_page){
+            const uint64_t page_size = kPageSize4K << (9 * (level - 1));
+            const uint64_t base = (entry.bits.addr << 12) & ~(page_size - 1);
+            return {base | (vaddr & (page_size - 1)), MAKE_ERROR(Error::kSuccess)};
+        }
+        table = entry.Pointer();
+    }
+    return {0, MAKE_ERROR(Error::kNoSuchEntry)};
+}
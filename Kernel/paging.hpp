@@ -75,7 +75,9 @@ union PageMapEntry{
         uint64_t dirty : 1;
         uint64_t huge_page : 1;
         uint64_t global : 1;
-        uint64_t : 3;
+        /** @brief カーネルが持ち主のページをアプリに見せている．CleanPageMaps で解放しない． */
+        uint64_t shared : 1;
+        uint64_t : 2;
 
         uint64_t addr : 40;
         uint64_t : 12;
@@ -95,5 +97,23 @@ Error FreePageMap(PageMapEntry* table);
 Error SetupPageMaps(LinearAddress4Level addr, size_t num_4kpages,
                     bool writable = true);
 Error CleanPageMaps(LinearAddress4Level addr);
+/** @brief CR3 に設定されていない PML4 について CleanPageMaps と同じことをする． */
+Error CleanPageMaps(PageMapEntry* pml4, LinearAddress4Level addr);
+/** @brief addr の 4KiB ページを既存の物理ページ phys_addr に対応付ける．
+ * 読み取り専用にすれば CleanPageMaps は phys_addr を解放しない．
+ */
+Error MapPhysicalPage(LinearAddress4Level addr, uint64_t phys_addr, bool writable);
+/** @brief addr の 4KiB ページを，カーネルが持ち主の物理ページ phys_addr に
+ * アプリから書き込めるページとして対応付ける．CleanPageMaps は phys_addr を解放しない．
+ */
+Error MapSharedPage(LinearAddress4Level addr, uint64_t phys_addr);
+/** @brief カーネルのページテーブルで addr をアプリから触れない書き込み可能なページとして
+ * phys_addr に対応付ける．CR3 がアプリの PML4 でも，カーネルの PML4 を書き換える． */
+Error MapKernelPage(LinearAddress4Level addr, uint64_t phys_addr);
+/** @brief MapKernelPage で作った addr の対応付けを消す．物理ページもページテーブルも解放しない． */
+void UnmapKernelPage(LinearAddress4Level addr);
 Error CopyPageMaps(PageMapEntry* dest, PageMapEntry* src, int part, int start);
 Error HandlePageFault(uint64_t error_code, uint64_t causal_addr);
+/** @brief 現在の CR3 のページテーブルをたどって vaddr の物理アドレスを求める．
+ * writable が nullptr でなければ，すべての段で書き込みが許されているかを書く． */
+WithError<uint64_t> LinearToPhysical(uint64_t vaddr, bool* writable = nullptr);
@@ -0,0 +1,266 @@
+#include "pixel_ops.hpp"
+
+#include <cstring>
+#include <immintrin.h>
+#include "asmfunc.h"
+#include "fpu.hpp"
+#include "logger.hpp"
+
+namespace {
+    uint32_t SwapRB(uint32_t x) {
+        return (x & 0xff00ff00u) | ((x >> 16) & 0xffu) | ((x & 0xffu) << 16);
+    }
+
+    /** @brief dst が align バイト境界に揃うまで 1 画素ずつ処理し，処理した画素数を返す． */
+    size_t HeadPixels(const uint32_t* dst, size_t n, uintptr_t align) {
+        const auto misalign = reinterpret_cast<uintptr_t>(dst) & (align - 1);
+        if (misalign == 0) {
+            return 0;
+        }
+        const size_t head = (align - misalign) / sizeof(uint32_t);
+        return head < n ? head : n;
+    }
+
+    // 汎用の実装．ベンチマークの基準にもする
+
+    void FillGeneric(uint32_t* dst, size_t n, uint32_t v) {
+        for (size_t i = 0; i < n; ++i) {
+            dst[i] = v;
+        }
+    }
+
+    void CopyGeneric(uint32_t* dst, const uint32_t* src, size_t n) {
+        memcpy(dst, src, n * sizeof(uint32_t));
+    }
+
+    void CopyKeyGeneric(uint32_t* dst, const uint32_t* src, size_t n, uint32_t key) {
+        for (size_t i = 0; i < n; ++i) {
+            if (src[i] != key) {
+                dst[i] = src[i];
+            }
+        }
+    }
+
+    void SwapRBGeneric(uint32_t* dst, const uint32_t* src, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            dst[i] = SwapRB(src[i]);
+        }
+    }
+
+    // SSE2 の実装．x86-64 なら必ず使える
+
+    template <bool kNonTemporal>
+    void FillSSE2(uint32_t* dst, size_t n, uint32_t v) {
+        const size_t head = HeadPixels(dst, n, 16);
+        FillGeneric(dst, head, v);
+        dst += head;
+        n -= head;
+
+        const __m128i vv = _mm_set1_epi32(v);
+        for (; n >= 4; n -= 4, dst += 4) {
+            auto p = reinterpret_cast<__m128i*>(dst);
+            if constexpr (kNonTemporal) {
+                _mm_stream_si128(p, vv);
+            } else {
+                _mm_store_si128(p, vv);
+            }
+        }
+        if constexpr (kNonTemporal) {
+            _mm_sfence();
+        }
+        FillGeneric(dst, n, v);
+    }
+
+    template <bool kNonTemporal>
+    void CopySSE2(uint32_t* dst, const uint32_t* src, size_t n) {
+        const size_t head = HeadPixels(dst, n, 16);
+        CopyGeneric(dst, src, head);
+        dst += head;
+        src += head;
+        n -= head;
+
+        for (; n >= 4; n -= 4, dst += 4, src += 4) {
+            const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+            auto p = reinterpret_cast<__m128i*>(dst);
+            if constexpr (kNonTemporal) {
+                _mm_stream_si128(p, s);
+            } else {
+                _mm_store_si128(p, s);
+            }
+        }
+        if constexpr (kNonTemporal) {
+            _mm_sfence();
+        }
+        CopyGeneric(dst, src, n);
+    }
+
+    void CopyKeySSE2(uint32_t* dst, const uint32_t* src, size_t n, uint32_t key) {
+        const __m128i vkey = _mm_set1_epi32(key);
+        for (; n >= 4; n -= 4, dst += 4, src += 4) {
+            const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+            const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst));
+            const __m128i is_key = _mm_cmpeq_epi32(s, vkey);
+            const __m128i r = _mm_or_si128(_mm_and_si128(is_key, d),
+                                           _mm_andnot_si128(is_key, s));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), r);
+        }
+        CopyKeyGeneric(dst, src, n, key);
+    }
+
+    template <bool kNonTemporal>
+    void SwapRBSSE2(uint32_t* dst, const uint32_t* src, size_t n) {
+        const size_t head = HeadPixels(dst, n, 16);
+        SwapRBGeneric(dst, src, head);
+        dst += head;
+        src += head;
+        n -= head;
+
+        const __m128i keep = _mm_set1_epi32(0xff00ff00);
+        const __m128i low = _mm_set1_epi32(0x000000ff);
+        for (; n >= 4; n -= 4, dst += 4, src += 4) {
+            const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+            const __m128i r = _mm_or_si128(
+                _mm_and_si128(s, keep),
+                _mm_or_si128(_mm_and_si128(_mm_srli_epi32(s, 16), low),
+                             _mm_slli_epi32(_mm_and_si128(s, low), 16)));
+            auto p = reinterpret_cast<__m128i*>(dst);
+            if constexpr (kNonTemporal) {
+                _mm_stream_si128(p, r);
+            } else {
+                _mm_store_si128(p, r);
+            }
+        }
+        if constexpr (kNonTemporal) {
+            _mm_sfence();
+        }
+        SwapRBGeneric(dst, src, n);
+    }
+
+    // AVX2 の実装．CPU が対応し，OS が YMM を保存する設定（XCR0）のときだけ使う
+
+    template <bool kNonTemporal>
+    __attribute__((target("avx2")))
+    void FillAVX2(uint32_t* dst, size_t n, uint32_t v) {
+        const size_t head = HeadPixels(dst, n, 32);
+        FillGeneric(dst, head, v);
+        dst += head;
+        n -= head;
+
+        const __m256i vv = _mm256_set1_epi32(v);
+        for (; n >= 8; n -= 8, dst += 8) {
+            auto p = reinterpret_cast<__m256i*>(dst);
+            if constexpr (kNonTemporal) {
+                _mm256_stream_si256(p, vv);
+            } else {
+                _mm256_store_si256(p, vv);
+            }
+        }
+        if constexpr (kNonTemporal) {
+            _mm_sfence();
+        }
+        FillGeneric(dst, n, v);
+    }
+
+    template <bool kNonTemporal>
+    __attribute__((target("avx2")))
+    void CopyAVX2(uint32_t* dst, const uint32_t* src, size_t n) {
+        const size_t head = HeadPixels(dst, n, 32);
+        CopyGeneric(dst, src, head);
+        dst += head;
+        src += head;
+        n -= head;
+
+        for (; n >= 8; n -= 8, dst += 8, src += 8) {
+            const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+            auto p = reinterpret_cast<__m256i*>(dst);
+            if constexpr (kNonTemporal) {
+                _mm256_stream_si256(p, s);
+            } else {
+                _mm256_store_si256(p, s);
+            }
+        }
+        if constexpr (kNonTemporal) {
+            _mm_sfence();
+        }
+        CopyGeneric(dst, src, n);
+    }
+
+    __attribute__((target("avx2")))
+    void CopyKeyAVX2(uint32_t* dst, const uint32_t* src, size_t n, uint32_t key) {
+        const __m256i vkey = _mm256_set1_epi32(key);
+        for (; n >= 8; n -= 8, dst += 8, src += 8) {
+            const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+            const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst));
+            const __m256i is_key = _mm256_cmpeq_epi32(s, vkey);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                                _mm256_blendv_epi8(s, d, is_key));
+        }
+        CopyKeyGeneric(dst, src, n, key);
+    }
+
+    template <bool kNonTemporal>
+    __attribute__((target("avx2")))
+    void SwapRBAVX2(uint32_t* dst, const uint32_t* src, size_t n) {
+        const size_t head = HeadPixels(dst, n, 32);
+        SwapRBGeneric(dst, src, head);
+        dst += head;
+        src += head;
+        n -= head;
+
+        const __m256i shuffle = _mm256_setr_epi8(
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        for (; n >= 8; n -= 8, dst += 8, src += 8) {
+            const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+            const __m256i r = _mm256_shuffle_epi8(s, shuffle);
+            auto p = reinterpret_cast<__m256i*>(dst);
+            if constexpr (kNonTemporal) {
+                _mm256_stream_si256(p, r);
+            } else {
+                _mm256_store_si256(p, r);
+            }
+        }
+        if constexpr (kNonTemporal) {
+            _mm_sfence();
+        }
+        SwapRBGeneric(dst, src, n);
+    }
+
+    const PixelOps kGenericOps{
+        "generic", FillGeneric, FillGeneric, CopyGeneric, CopyGeneric,
+        CopyKeyGeneric, SwapRBGeneric, SwapRBGeneric,
+    };
+    const PixelOps kSSE2Ops{
+        "sse2", FillSSE2<false>, FillSSE2<true>, CopySSE2<false>, CopySSE2<true>,
+        CopyKeySSE2, SwapRBSSE2<false>, SwapRBSSE2<true>,
+    };
+    const PixelOps kAVX2Ops{
+        "avx2", FillAVX2<false>, FillAVX2<true>, CopyAVX2<false>, CopyAVX2<true>,
+        CopyKeyAVX2, SwapRBAVX2<false>, SwapRBAVX2<true>,
+    };
+
+    bool avx2_available = false;
+}
+
+const PixelOps* pixel_ops = &kSSE2Ops;
+
+void InitializePixelOps() {
+    uint32_t eax, ebx, ecx, edx;
+    CPUID(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 7) {
+        CPUID(7, 0, &eax, &ebx, &ecx, &edx);
+        const bool avx2 = (ebx >> 5) & 1;
+        avx2_available = avx2 && (FPUFeatures() & kFPUFeatureAVX);
+    }
+
+    pixel_ops = avx2_available ? &kAVX2Ops : &kSSE2Ops;
+    Log(kInfo, "pixel ops: %s\n", pixel_ops->name);
+}
+
+std::vector<const PixelOps*> AvailablePixelOps() {
+    std::vector<const PixelOps*> ops{&kGenericOps, &kSSE2Ops};
+    if (avx2_available) {
+        ops.push_back(&kAVX2Ops);
+    }
+    return ops;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file pixel_ops.hpp
+ *
+ * 1 画素 32 ビットの画素列を塗る・複写する処理（カーネル）を集めたファイル．
+ * SSE2 と AVX2 の実装を用意し，起動時に CPUID で使うものを選ぶ．
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/** @brief 画素列の処理の 1 組．n は画素数で，どの関数も dst, src の整列を仮定しない． */
+struct PixelOps {
+    const char* name;
+    /** @brief dst[0, n) を v で埋める． */
+    void (*fill)(uint32_t* dst, size_t n, uint32_t v);
+    /** @brief fill と同じだが，キャッシュを汚さない書き込み（non-temporal store）を使う． */
+    void (*fill_nt)(uint32_t* dst, size_t n, uint32_t v);
+    /** @brief src[0, n) を dst に複写する．領域は重なってはいけない． */
+    void (*copy)(uint32_t* dst, const uint32_t* src, size_t n);
+    /** @brief copy と同じだが，キャッシュを汚さない書き込みを使う．
+     * 書き込むだけで読み返さない GOP のフレームバッファ向け． */
+    void (*copy_nt)(uint32_t* dst, const uint32_t* src, size_t n);
+    /** @brief src のうち key と等しくない画素だけを dst に複写する． */
+    void (*copy_key)(uint32_t* dst, const uint32_t* src, size_t n, uint32_t key);
+    /** @brief 下位 1 バイト目と 3 バイト目を入れ替えて複写する（RGB と BGR の変換）． */
+    void (*swap_rb)(uint32_t* dst, const uint32_t* src, size_t n);
+    /** @brief swap_rb と同じだが，キャッシュを汚さない書き込みを使う． */
+    void (*swap_rb_nt)(uint32_t* dst, const uint32_t* src, size_t n);
+};
+
+/** @brief 使う実装．InitializePixelOps の前は SSE2 版を指す． */
+extern const PixelOps* pixel_ops;
+
+/** @brief CPUID と XCR0 を調べて pixel_ops を選ぶ．InitializeFPU の後に呼ぶ． */
+void InitializePixelOps();
+
+/** @brief この CPU で使える実装をすべて返す．ベンチマーク用． */
+std::vector<const PixelOps*> AvailablePixelOps();
@@ -0,0 +1,111 @@
+#include "region.hpp"
+
+#include <algorithm>
+
+namespace {
+    Rectangle<int> Intersection(const Rectangle<int>& a, const Rectangle<int>& b) {
+        const auto pos = ElementMax(a.pos, b.pos);
+        const auto end = ElementMin(a.pos + a.size, b.pos + b.size);
+        return {pos, end - pos};
+    }
+
+    /** @brief r から hole を除いた部分を最大 4 つの矩形にして out に加える． */
+    void SubtractRect(const Rectangle<int>& r, const Rectangle<int>& hole,
+                      std::vector<Rectangle<int>>& out) {
+        const auto overlap = Intersection(r, hole);
+        if (IsEmpty(overlap)) {
+            out.push_back(r);
+            return;
+        }
+
+        const auto r_end = r.pos + r.size;
+        const auto o_end = overlap.pos + overlap.size;
+        // 上と下の帯は r の幅いっぱい，左右の帯は重なる部分の高さだけ
+        if (r.pos.y < overlap.pos.y) {
+            out.push_back({r.pos, {r.size.x, overlap.pos.y - r.pos.y}});
+        }
+        if (o_end.y < r_end.y) {
+            out.push_back({{r.pos.x, o_end.y}, {r.size.x, r_end.y - o_end.y}});
+        }
+        if (r.pos.x < overlap.pos.x) {
+            out.push_back({{r.pos.x, overlap.pos.y}, {overlap.pos.x - r.pos.x, overlap.size.y}});
+        }
+        if (o_end.x < r_end.x) {
+            out.push_back({{o_end.x, overlap.pos.y}, {r_end.x - o_end.x, overlap.size.y}});
+        }
+    }
+}
+
+void Region::Add(const Rectangle<int>& r) {
+    if (IsEmpty(r)) {
+        return;
+    }
+
+    std::vector<Rectangle<int>> pieces{r}, next;
+    for (const auto& existing : rects_) {
+        next.clear();
+        for (const auto& piece : pieces) {
+            SubtractRect(piece, existing, next);
+        }
+        pieces.swap(next);
+        if (pieces.empty()) {
+            return;
+        }
+    }
+    rects_.insert(rects_.end(), pieces.begin(), pieces.end());
+
+    if (rects_.size() > kMaxRects) {
+        const auto bounds = Bounds();
+        rects_.assign(1, bounds);
+    }
+}
+
+void Region::Add(const Region& other) {
+    for (const auto& r : other.rects_) {
+        Add(r);
+    }
+}
+
+void Region::Subtract(const Rectangle<int>& r) {
+    if (IsEmpty(r) || rects_.empty()) {
+        return;
+    }
+
+    std::vector<Rectangle<int>> result;
+    for (const auto& rect : rects_) {
+        SubtractRect(rect, r, result);
+    }
+    rects_.swap(result);
+}
+
+Region Region::Intersect(const Rectangle<int>& r) const {
+    Region result;
+    for (const auto& rect : rects_) {
+        const auto overlap = Intersection(rect, r);
+        if (!IsEmpty(overlap)) {
+            result.rects_.push_back(overlap);
+        }
+    }
+    return result;
+}
+
+Rectangle<int> Region::Bounds() const {
+    if (rects_.empty()) {
+        return {{0, 0}, {0, 0}};
+    }
+    auto pos = rects_[0].pos;
+    auto end = rects_[0].pos + rects_[0].size;
+    for (const auto& r : rects_) {
+        pos = ElementMin(pos, r.pos);
+        end = ElementMax(end, r.pos + r.size);
+    }
+    return {pos, end - pos};
+}
+
+uint64_t Region::Area() const {
+    uint64_t area = 0;
+    for (const auto& r : rects_) {
+        area += static_cast<uint64_t>(r.size.x) * r.size.y;
+    }
+    return area;
+}
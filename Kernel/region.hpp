@@ -0,0 +1,47 @@
+/**
+ * @file region.hpp
+ *
+ * 重ならない矩形の集まりで画面上の領域を表すクラス．
+ * 再描画が必要な領域（ダメージ）や，上のレイヤに隠されていない領域を求めるのに使う．
+ */
+
+#pragma once
+
+#include <vector>
+#include "graphics.hpp"
+
+/** @brief 幅か高さが 0 以下なら true． */
+inline bool IsEmpty(const Rectangle<int>& r) {
+    return r.size.x <= 0 || r.size.y <= 0;
+}
+
+/** @brief 重ならない矩形の集まり．
+ *
+ * 矩形の数が kMaxRects を超えたら全体を囲む 1 つの矩形にまとめる．
+ * まとめると実際より広くなるが，描き過ぎるだけで描き漏れはしない．
+ */
+class Region {
+    public:
+        static const size_t kMaxRects = 32;
+
+        Region() = default;
+
+        /** @brief r を加える．既にある部分と重なるところは加えない． */
+        void Add(const Rectangle<int>& r);
+        void Add(const Region& other);
+        /** @brief r と重なる部分を取り除く． */
+        void Subtract(const Rectangle<int>& r);
+        /** @brief r との共通部分を返す． */
+        Region Intersect(const Rectangle<int>& r) const;
+        /** @brief 全体を囲む最小の矩形．空なら大きさ 0． */
+        Rectangle<int> Bounds() const;
+        /** @brief 含まれる画素の数． */
+        uint64_t Area() const;
+
+        bool Empty() const { return rects_.empty(); }
+        void Clear() { rects_.clear(); }
+        const std::vector<Rectangle<int>>& Rects() const { return rects_; }
+
+    private:
+        std::vector<Rectangle<int>> rects_{};
+};
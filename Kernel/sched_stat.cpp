@@ -0,0 +1,95 @@
+#include "sched_stat.hpp"
+
+#include <cstdarg>
+#include <cstdio>
+#include "file.hpp"
+#include "interrupt.hpp"
+#include "logger.hpp"
+#include "task.hpp"
+
+namespace {
+    /** @brief fd が nullptr ならログに，そうでなければ fd に 1 行書く． */
+    void Print(FileDescriptor* fd, const char* format, ...) {
+        va_list ap;
+        char s[128];
+
+        va_start(ap, format);
+        const int len = vsprintf(s, format, ap);
+        va_end(ap);
+
+        if (fd) {
+            fd->Write(s, len);
+        } else {
+            Log(kWarn, "%s", s);
+        }
+    }
+
+    void PrintHistogram(FileDescriptor* fd, const char* name, const LogHistogram& hist) {
+        if (hist.Samples() == 0) {
+            return;
+        }
+        Print(fd, "  %s: n=%lu avg=%luus max=%luus\n", name, hist.Samples(),
+              hist.SumNs() / hist.Samples() / 1000, hist.MaxNs() / 1000);
+        for (int b = 0; b < LogHistogram::kBuckets; ++b) {
+            if (hist.Count(b) == 0) {
+                continue;
+            }
+            if (const auto limit = LogHistogram::BucketLimitUs(b)) {
+                Print(fd, "    <%8luus %lu\n", limit, hist.Count(b));
+            } else {
+                Print(fd, "    >=%7luus %lu\n",
+                      LogHistogram::BucketLimitUs(b - 1), hist.Count(b));
+            }
+        }
+    }
+}
+
+void LogHistogram::Add(uint64_t ns) {
+    const uint64_t us = ns / 1000;
+    int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    if (bucket >= kBuckets) {
+        bucket = kBuckets - 1;
+    }
+    ++counts_[bucket];
+    ++samples_;
+    sum_ns_ += ns;
+    if (ns > max_ns_) {
+        max_ns_ = ns;
+    }
+}
+
+void LogHistogram::Clear() {
+    *this = LogHistogram{};
+}
+
+uint64_t LogHistogram::BucketLimitUs(int bucket) {
+    if (bucket >= kBuckets - 1) {
+        return 0;
+    }
+    return uint64_t{1} << bucket;
+}
+
+void PrintSchedStats(FileDescriptor* fd) {
+    std::array<SchedLevelStats, TaskManager::kMaxLevel + 1> levels;
+    std::vector<TaskSchedStat> tasks;
+    // 表示中に値が変わらないように，割り込みを禁止して写しを取ってから書き出す
+    const auto rflags = SaveAndDisableInterrupts();
+    task_manager->GetSchedStats(levels, tasks);
+    RestoreInterrupts(rflags);
+
+    for (int lv = TaskManager::kMaxLevel; lv >= 0; --lv) {
+        const auto& stats = levels[lv];
+        if (stats.wakeup_latency.Samples() == 0 && stats.slice.Samples() == 0) {
+            continue;
+        }
+        Print(fd, "level %d\n", lv);
+        PrintHistogram(fd, "wakeup latency", stats.wakeup_latency);
+        PrintHistogram(fd, "slice", stats.slice);
+    }
+
+    Print(fd, "   ID LV  voluntary involuntary\n");
+    for (const auto& t : tasks) {
+        Print(fd, "%5lu %2d %10lu %11lu\n", t.id, t.level,
+              t.voluntary_switches, t.involuntary_switches);
+    }
+}
@@ -0,0 +1,59 @@
+/**
+ * @file sched_stat.hpp
+ *
+ * スケジューラの遅延とタイムスライスの使い方を数える統計のファイル．
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class FileDescriptor;
+
+/** @brief 値を 2 のべき乗の区間に分けて数えるヒストグラム（単位はマイクロ秒）．
+ *
+ * 区間 0 は 1us 未満，区間 i は [2^(i-1), 2^i) us．最後の区間はそれ以上すべて．
+ */
+class LogHistogram {
+    public:
+        static const int kBuckets = 24;
+
+        void Add(uint64_t ns);
+        void Clear();
+        uint64_t Count(int bucket) const { return counts_[bucket]; }
+        uint64_t Samples() const { return samples_; }
+        uint64_t SumNs() const { return sum_ns_; }
+        uint64_t MaxNs() const { return max_ns_; }
+        /** @brief 区間 bucket の上限（us，その値を含まない）．最後の区間は 0 を返す． */
+        static uint64_t BucketLimitUs(int bucket);
+
+    private:
+        std::array<uint64_t, kBuckets> counts_{};
+        uint64_t samples_{0};
+        uint64_t sum_ns_{0};
+        uint64_t max_ns_{0};
+};
+
+/** @brief 優先度レベルごとの統計． */
+struct SchedLevelStats {
+    /** @brief Wakeup されてから実際に実行を始めるまでの時間． */
+    LogHistogram wakeup_latency;
+    /** @brief 実行を始めてから他のタスクに切り替わるまでの時間． */
+    LogHistogram slice;
+};
+
+/** @brief タスクごとの切り替え回数． */
+struct TaskSchedStat {
+    uint64_t id;
+    int level;
+    /** @brief 自分から眠った・終了した回数． */
+    uint64_t voluntary_switches;
+    /** @brief タイマ割り込みで横取りされた回数． */
+    uint64_t involuntary_switches;
+};
+
+/** @brief 統計を fd に書き出す．fd が nullptr ならログに出す． */
+void PrintSchedStats(FileDescriptor* fd);
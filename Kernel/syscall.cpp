@@ -1,9 +1,11 @@
 #include "syscall.hpp"
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <cerrno>
 #include <cmath>
+#include <cstring>
 #include <fcntl.h>
 
 #include "asmfunc.h"
@@ -15,6 +17,51 @@
 #include "timer.hpp"
 #include "keyboard.hpp"
 #include "app_event.hpp"
+#include "app_surface.hpp"
+#include "app_draw.hpp"
+#include "futex.hpp"
+#include "idle.hpp"
+#include "interrupt.hpp"
+#include "paging.hpp"
+#include "memory_manager.hpp"
+
+namespace {
+    /** @brief スレッドのユーザスタックの大きさ．アプリのメインスレッドと同じ． */
+    const size_t kThreadStackBytes = 16 * 4096;
+
+    struct ThreadStart {
+        uint64_t entry;
+        uint64_t user_rsp;
+        uint64_t* start_args;
+    };
+
+    /** @brief CreateThread で作ったタスクの本体．ユーザモードで entry を呼ぶ． */
+    void TaskAppThread(uint64_t task_id, int64_t data){
+        const auto start = reinterpret_cast<ThreadStart*>(data);
+        const ThreadStart s = *start;
+        delete start;
+
+        auto rflags = SaveAndDisableInterrupts();
+        Task& task = task_manager->CurrentTask();
+        RestoreInterrupts(rflags);
+
+        const int ret = CallApp(static_cast<int>(task_id),
+                                reinterpret_cast<char**>(s.start_args),
+                                3 << 3 | 3, s.entry, s.user_rsp,
+                                &task.OSStackPointer());
+
+        rflags = SaveAndDisableInterrupts();
+        task.Context().cr3 = 0;
+        ResetCR3();
+        auto old_space = task.ResetSpace();
+        RestoreInterrupts(rflags);
+        // 最後のスレッドならここでアドレス空間が解放される．割り込みを許可したまま行う
+        old_space.reset();
+
+        DisableInterrupts();
+        task_manager->Finish(ret);
+    }
+}
 
 namespace syscall {
     struct Result {
@@ -48,9 +95,9 @@ namespace syscall {
             return {0, E2BIG};
         }
 
-        __asm__("cli");
+        DisableInterrupts();
         auto& task = task_manager->CurrentTask();
-        __asm__("sti");
+        EnableInterrupts();
 
         if(fd < 0 || task.Files().size() <= fd || !task.Files()[fd]){
             return {0, EBADF};
@@ -59,9 +106,9 @@ namespace syscall {
     }
 
     SYSCALL(Exit){
-        __asm__("cli");
+        DisableInterrupts();
         auto& task = task_manager->CurrentTask();
-        __asm__("sti");
+        EnableInterrupts();
 
         return {task.OSStackPointer(), static_cast<int>(arg1)};
     }
@@ -72,7 +119,7 @@ namespace syscall {
         const auto win = std::make_shared<ToplevelWindow>(
             w, h, screen_config.pixel_format, title);
         
-        __asm__("cli");
+        LockGuard lock{layer_manager->GetLock()};
         const auto layer_id = layer_manager->NewLayer()
             .SetWindow(win)
             .SetDraggable(true)
@@ -80,35 +127,153 @@ namespace syscall {
             .ID();
         active_layer->Activate(layer_id);
 
-        const auto task_id = task_manager->CurrentTask().ID();
-        layer_task_map->insert(std::make_pair(layer_id, task_id));
-        __asm__("sti");
+        const auto rflags = SaveAndDisableInterrupts();
+        auto& task = task_manager->CurrentTask();
+        layer_task_map->insert(std::make_pair(layer_id, task.ID()));
+        RestoreInterrupts(rflags);
+        {
+            LockGuard space_lock{task.Space().lock};
+            task.Space().windows.push_back(layer_id);
+        }
 
         return {layer_id, 0};
     }
 
     namespace {
+        void DrawLine(Window& win, int x0, int y0, int x1, int y1, uint32_t color){
+            auto sign = [](int x){
+                return (x > 0) ? 1 : (x < 0) ? - 1 : 0;
+            };
+            const int dx = x1 - x0 + sign(x1 - x0);
+            const int dy = y1 - y0 + sign(y1 - y0);
+
+            if(dx == 0 && dy == 0){
+                win.Writer()->Write({x0, y0}, ToColor(color));
+                return;
+            }
+
+            const auto floord = static_cast<double(*)(double)>(floor);
+            const auto ceild = static_cast<double(*)(double)>(ceil);
+
+            if(abs(dx) >= abs(dy)){
+                if(dx < 0){
+                    std::swap(x0, x1);
+                    std::swap(y0, y1);
+                }
+                const auto roundish = y1 >= y0 ? floord : ceild;
+                const double m = static_cast<double>(dy) / dx;
+                for(int x = x0; x <= x1; ++x){
+                    const int y = roundish(m * (x - x0) + y0);
+                    win.Writer()->Write({x, y}, ToColor(color));
+                }
+            } else {
+                if(dy < 0){
+                    std::swap(x0, x1);
+                    std::swap(y0, y1);
+                }
+                const auto roundish = x1 >= x0 ? floord : ceild;
+                const double m = static_cast<double>(dx) / dy;
+                for(int y = y0; y <= y1; ++y){
+                    const int x = roundish(m * (y - y0) + x0);
+                    win.Writer()->Write({x, y}, ToColor(color));
+                }
+            }
+        }
+
+        /** @brief 描画命令を 1 つ実行する．命令が壊れているか，ウィンドウからはみ出すなら false．
+         *
+         * cmd はカーネルに写した命令の頭．payload はアプリのメモリを指したままなので，
+         * 同じアプリの他のスレッドが書き換えても範囲の外を読み書きしないよう，
+         * 大きさや位置は cmd からだけ取る．
+         */
+        bool ExecuteDrawCommand(Window& win, const DrawCommand& cmd, const uint8_t* payload){
+            const Rectangle<int> win_area{{0, 0}, win.Size()};
+            auto inside = [&win_area](const Rectangle<int>& r){
+                return r.size.x > 0 && r.size.y > 0 &&
+                       r.pos.x >= 0 && r.pos.y >= 0 &&
+                       // pos + size はあふれることがあるので，引き算で比べる
+                       r.pos.x <= win_area.size.x && r.size.x <= win_area.size.x - r.pos.x &&
+                       r.pos.y <= win_area.size.y && r.size.y <= win_area.size.y - r.pos.y;
+            };
+            const size_t payload_bytes = cmd.size - sizeof(cmd);
+
+            switch(cmd.type){
+                case kDrawFill:
+                    if(!inside({{cmd.x, cmd.y}, {cmd.w, cmd.h}})){
+                        return false;
+                    }
+                    FillRectangle(*win.Writer(), {cmd.x, cmd.y}, {cmd.w, cmd.h}, ToColor(cmd.color));
+                    return true;
+                case kDrawLine:
+                    if(!inside({{cmd.x, cmd.y}, {1, 1}}) || !inside({{cmd.w, cmd.h}, {1, 1}})){
+                        return false;
+                    }
+                    DrawLine(win, cmd.x, cmd.y, cmd.w, cmd.h, cmd.color);
+                    return true;
+                case kDrawText: {
+                    // 調べてから描くまでに NUL を消されないよう，カーネルに写してから使う
+                    char s[kDrawTextMaxBytes];
+                    const size_t copy_bytes = std::min(payload_bytes, sizeof(s));
+                    memcpy(s, payload, copy_bytes);
+                    const size_t len = strnlen(s, copy_bytes);
+                    if(len == copy_bytes){
+                        return false;  // NUL で終わっていないか，長すぎる
+                    }
+                    if(len > 0 && !inside({{cmd.x, cmd.y}, {8 * static_cast<int>(len), 16}})){
+                        return false;
+                    }
+                    WriteString(*win.Writer(), {cmd.x, cmd.y}, s, ToColor(cmd.color));
+                    return true;
+                }
+                case kDrawBlit: {
+                    if(!inside({{cmd.x, cmd.y}, {cmd.w, cmd.h}}) ||
+                       payload_bytes < sizeof(uint32_t) * cmd.w * cmd.h){
+                        return false;
+                    }
+                    const auto pixels = reinterpret_cast<const uint32_t*>(payload);
+                    // 64 画素ずつ PixelColor に直して 1 行分の書き込みにまとめる
+                    PixelColor row[64];
+                    for(int dy = 0; dy < cmd.h; ++dy){
+                        for(int dx = 0; dx < cmd.w; dx += 64){
+                            const int n = std::min(64, cmd.w - dx);
+                            for(int i = 0; i < n; ++i){
+                                row[i] = ToColor(pixels[cmd.w * dy + dx + i]);
+                            }
+                            win.WriteRow({cmd.x + dx, cmd.y + dy}, row, n);
+                        }
+                    }
+                    return true;
+                }
+                default:
+                    return false;
+            }
+        }
+
         template <class Func, class... Args>
         Result DoWinFunc(Func f, uint64_t layer_id_flags, Args... args){
             const uint32_t layer_flags = layer_id_flags >> 32;
             const unsigned int layer_id = layer_id_flags & 0xffffffff;
 
-            __asm__("cli");
-            auto layer = layer_manager->FindLayer(layer_id);
-            __asm__("sti");
-            if(layer == nullptr){
+            // ウィンドウを持っておけば，描いている間にレイヤが閉じられても壊れない
+            std::shared_ptr<Window> window;
+            {
+                LockGuard lock{layer_manager->GetLock()};
+                if(auto layer = layer_manager->FindLayer(layer_id)){
+                    window = layer->GetWindow();
+                }
+            }
+            if(!window){
                 return { 0, EBADF };
             }
 
-            const auto res = f(*layer->GetWindow(), args...);
+            const auto res = f(*window, args...);
             if(res.error){
                 return res;
             }
 
+            // 合成はコンポジタがフレームごとに行うので，ここではダメージを記録するだけ
             if((layer_flags & 1) == 0){
-                __asm__("cli");
-                layer_manager->Draw(layer_id);
-                __asm__("sti");
+                layer_manager->AddDamage(layer_id);
             }
 
             return res;
@@ -148,45 +313,42 @@ namespace syscall {
         return DoWinFunc(
             [](Window& win,
                 int x0, int y0, int x1, int y1, uint32_t color){
-                auto sign = [](int x){
-                    return (x > 0) ? 1 : (x < 0) ? - 1 : 0;
-                };
-                const int dx = x1 - x0 + sign(x1 - x0);
-                const int dy = y1 - y0 + sign(y1 - y0);
-
-                if(dx == 0 && dy == 0){
-                    win.Writer()->Write({x0, y0}, ToColor(color));
-                    return Result{ 0, 0 };
-                }
-
-                const auto floord = static_cast<double(*)(double)>(floor);
-                const auto ceild = static_cast<double(*)(double)>(ceil);
+                DrawLine(win, x0, y0, x1, y1, color);
+                return Result { 0, 0 };
+            }, arg1, arg2, arg3, arg4, arg5, arg6);
+    }
 
-                if(abs(dx) >= abs(dy)){
-                    if(dx < 0){
-                        std::swap(x0, x1);
-                        std::swap(y0, y1);
-                    }
-                    const auto roundish = y1 >= y0 ? floord : ceild;
-                    const double m = static_cast<double>(dy) / dx;
-                    for(int x = x0; x <= x1; ++x){
-                        const int y = roundish(m * (x - x0) + y0);
-                        win.Writer()->Write({x, y}, ToColor(color));
+    /** @brief arg2 から arg3 バイトに並べた描画命令をまとめて実行し，最後に 1 回だけ再描画する．
+     *
+     * 実行した命令の数を返す．壊れた命令やウィンドウからはみ出す命令があればそこで止め，
+     * 再描画せずに EINVAL を返す．
+     */
+    SYSCALL(WinDrawBatch){
+        if(arg2 < 0x8000'0000'0000'0000 || arg3 > ~arg2){
+            return { 0, EFAULT };
+        }
+        return DoWinFunc(
+            [](Window& win, const uint8_t* buf, size_t bytes){
+                uint64_t count = 0;
+                size_t offset = 0;
+                while(offset < bytes){
+                    if(bytes - offset < sizeof(DrawCommand)){
+                        return Result{ count, EINVAL };
                     }
-                } else {
-                    if(dy < 0){
-                        std::swap(x0, x1);
-                        std::swap(y0, y1);
+                    DrawCommand cmd;
+                    memcpy(&cmd, buf + offset, sizeof(cmd));
+                    if(cmd.size < sizeof(DrawCommand) || cmd.size % 8 != 0 ||
+                       cmd.size > bytes - offset){
+                        return Result{ count, EINVAL };
                     }
-                    const auto roundish = x1 >= x0 ? floord : ceild;
-                    const double m = static_cast<double>(dx) / dy;
-                    for(int y = y0; y <= y1; ++y){
-                        const int x = roundish(m * (y - y0) + x0);
-                        win.Writer()->Write({x, y}, ToColor(color));
+                    if(!ExecuteDrawCommand(win, cmd, buf + offset + sizeof(cmd))){
+                        return Result{ count, EINVAL };
                     }
+                    offset += cmd.size;
+                    ++count;
                 }
-                return Result { 0, 0 };
-            }, arg1, arg2, arg3, arg4, arg5, arg6);
+                return Result{ count, 0 };
+            }, arg1, reinterpret_cast<const uint8_t*>(arg2), static_cast<size_t>(arg3));
     }
 
     SYSCALL(CloseWindow){
@@ -205,19 +367,17 @@ namespace syscall {
         const auto app_events = reinterpret_cast<AppEvent*>(arg1);
         const size_t len = arg2;
 
-        __asm__("cli");
+        DisableInterrupts();
         auto& task = task_manager->CurrentTask();
-        __asm__("sti");
+        EnableInterrupts();
         size_t i = 0;
 
         while(i < len){
-            __asm__("cli");
-            auto msg = task.ReceiveMessage();
-            if(!msg && i == 0){
-                task.Sleep();
-                continue;
-            }
-            __asm__("sti");
+            DisableInterrupts();
+            // 1 つも受け取っていなければ届くまで待つ
+            std::optional<Message> msg =
+                i == 0 ? task.WaitMessage() : task.ReceiveMessage();
+            EnableInterrupts();
 
             if(!msg) {
                 break;
@@ -282,18 +442,21 @@ namespace syscall {
             return { 0, EINVAL };
         }
 
-        __asm__("cli");
+        DisableInterrupts();
         const uint64_t task_id = task_manager->CurrentTask().ID();
-        __asm__("sti");
+        EnableInterrupts();
 
         unsigned long timeout = arg3 * kTimerFreq / 1000;
   if (mode & 1) { // relative
             timeout += timer_manager->CurrentTick();
         }
 
-        __asm__("cli");
-        timer_manager->AddTimer(Timer{timeout, -timer_value, task_id});
-        __asm__("sti");
+        DisableInterrupts();
+        const auto timer_id = timer_manager->AddTimer(Timer{timeout, -timer_value, task_id});
+        EnableInterrupts();
+        if (timer_id == kInvalidTimerID){
+            return { 0, EAGAIN };
+        }
         return { timeout * 1000 / kTimerFreq, 0 };
     }
 
@@ -323,9 +486,9 @@ namespace syscall {
     SYSCALL(OpenFile){
         const char* path = reinterpret_cast<const char*>(arg1);
         const int flags = arg2;
-        __asm__("cli");
+        DisableInterrupts();
         auto& task = task_manager->CurrentTask();
-        __asm__("sti");
+        EnableInterrupts();
 
         if(strcmp(path, "@stdin") == 0) {
             return { 0, 0 };
@@ -355,9 +518,9 @@ namespace syscall {
         const int fd = arg1;
         void* buf = reinterpret_cast<void*>(arg2);
         size_t count = arg3;
-        __asm__("cli");
+        DisableInterrupts();
         auto& task = task_manager->CurrentTask();
-        __asm__("sti");
+        EnableInterrupts();
 
         if(fd < 0 || task.Files().size() <= fd || !task.Files()[fd]){
             return {0, EBADF};
@@ -369,12 +532,15 @@ namespace syscall {
     SYSCALL(DemandPages) {
         const size_t num_pages = arg1;
         // const int flags = arg2;
-        __asm__("cli");
+        DisableInterrupts();
         auto& task = task_manager->CurrentTask();
-        __asm__("sti");
+        EnableInterrupts();
 
+        LockGuard lock{task.Space().lock};
+        const auto rflags = SaveAndDisableInterrupts();
         const uint64_t dp_end = task.DPagingEnd();
         task.SetDPagingEnd(dp_end + 4096 * num_pages);
+        RestoreInterrupts(rflags);
         return {dp_end, 0};
     }
 
@@ -383,28 +549,296 @@ namespace syscall {
         size_t* file_size = reinterpret_cast<size_t*>(arg2);
         //const int flags = arg3;
 
-        __asm__("cli");
+        DisableInterrupts();
         auto& task = task_manager->CurrentTask();
-        __asm__("sti");
+        EnableInterrupts();
 
         if(fd < 0 || task.Files().size() <= fd || !task.Files()[fd]){
             return {0, EBADF};
         }
 
-        *file_size = task.Files()[fd]->Size();
+        const size_t size = task.Files()[fd]->Size();
+        *file_size = size;
+
+        LockGuard lock{task.Space().lock};
+        // ページフォールトの処理が file_maps を読むので，書き換える間は割り込みを禁止する
+        const auto rflags = SaveAndDisableInterrupts();
         const uint64_t vaddr_end = task.FileMapEnd();
-        const uint64_t vaddr_begin = (vaddr_end - *file_size) & 0xffff'ffff'ffff'f000;
+        const uint64_t vaddr_begin = (vaddr_end - size) & 0xffff'ffff'ffff'f000;
         task.SetFileMapEnd(vaddr_begin);
         task.FileMaps().push_back(FileMapping{ fd, vaddr_begin, vaddr_end});
+        RestoreInterrupts(rflags);
         return { vaddr_begin, 0 };
     }
+
+    SYSCALL(GetTimeNs){
+        return { timer_manager->CurrentTimeNs(), 0 };
+    }
+
+    /** @brief 現在のタスクの nice 値を設定し，それまでの値を返す．
+     * アプリの終了時に元の値に戻る． */
+    SYSCALL(SetNice){
+        const int nice = static_cast<int>(arg1);
+        const auto rflags = SaveAndDisableInterrupts();
+        auto& task = task_manager->CurrentTask();
+        const int old_nice = task.Nice();
+        auto err = task_manager->SetNice(&task, nice);
+        RestoreInterrupts(rflags);
+        if(err){
+            return { 0, EINVAL };
+        }
+        return { static_cast<uint64_t>(old_nice), 0 };
+    }
+
+    SYSCALL(FutexWait){
+        const uint64_t addr = arg1;
+        const uint32_t expected = arg2;
+        return { 0, ::FutexWait(addr, expected) };
+    }
+
+    SYSCALL(FutexWake){
+        const uint64_t addr = arg1;
+        const size_t n = arg2;
+        size_t woken = 0;
+        const int err = ::FutexWake(addr, n, woken);
+        return { woken, err };
+    }
+
+    /**
+     * @brief 呼び出したアプリと同じアドレス空間で動くスレッドを作る．
+     *
+     * スレッドは start(thread_id, args) として始まる．args は新しいスレッドの
+     * スタックの先頭に置いた { func, arg } を指す．start は Exit で終わること．
+     * スレッドから Exit を呼ぶとそのスレッドだけが終わる．
+     */
+    SYSCALL(CreateThread){
+        const uint64_t start = arg1, func = arg2, arg = arg3;
+        if(start < 0xffff'8000'0000'0000){
+            return { 0, EFAULT };
+        }
+
+        auto rflags = SaveAndDisableInterrupts();
+        auto& task = task_manager->CurrentTask();
+        RestoreInterrupts(rflags);
+
+        // ファイルマップと同じ領域から，下に 1 ページのガードを空けて確保する．
+        // ページテーブルはページフォールトの処理も書き換えるので，割り込みを禁止して作る
+        uint64_t stack_end;
+        {
+            LockGuard lock{task.Space().lock};
+            rflags = SaveAndDisableInterrupts();
+            stack_end = task.FileMapEnd();
+            const uint64_t stack_begin = stack_end - kThreadStackBytes;
+            auto err = SetupPageMaps(LinearAddress4Level{stack_begin},
+                                     kThreadStackBytes / 4096);
+            if(!err){
+                task.SetFileMapEnd(stack_begin - 4096);
+            }
+            RestoreInterrupts(rflags);
+            if(err){
+                return { 0, ENOMEM };
+            }
+        }
+
+        // カーネルスタックを使い切っていれば，停止せずにアプリに知らせる．
+        // NewTask は終了したタスクを回収するので，割り込みを許可したまま呼ぶ
+        auto [thread_ptr, err] = task_manager->NewTask();
+        if(err){
+            return { 0, EAGAIN };
+        }
+
+        auto start_args = reinterpret_cast<uint64_t*>(stack_end - 16);
+        start_args[0] = func;
+        start_args[1] = arg;
+        auto thread_start = new ThreadStart{
+            start, stack_end - 24, start_args
+        };
+
+        rflags = SaveAndDisableInterrupts();
+        Task& thread = thread_ptr->InitContext(TaskAppThread, reinterpret_cast<int64_t>(thread_start))
+            .ShareSpace(task);
+        // 割り込みを許可した後は thread が終了して使い回されることがあるので，ID はここで読む
+        const uint64_t thread_id = thread.ID();
+        task.Space().threads.push_back(thread_id);
+        task_manager->Wakeup(&thread, task.Level());
+        RestoreInterrupts(rflags);
+        return { thread_id, 0 };
+    }
+
+    /** @brief CreateThread で作ったスレッドの終了を待ち，終了コードを返す． */
+    SYSCALL(JoinThread){
+        const uint64_t thread_id = arg1;
+
+        const auto rflags = SaveAndDisableInterrupts();
+        auto& threads = task_manager->CurrentTask().Space().threads;
+        auto it = std::find(threads.begin(), threads.end(), thread_id);
+        const bool found = it != threads.end();
+        if(found){
+            threads.erase(it);
+        }
+        RestoreInterrupts(rflags);
+        if(!found){
+            return { 0, ESRCH };
+        }
+
+        auto [exit_code, err] = task_manager->WaitFinish(thread_id);
+        if(err){
+            return { 0, ESRCH };
+        }
+        return { static_cast<uint64_t>(exit_code), 0 };
+    }
+
+    /** @brief CPU の使用率を 0.1% 単位で返す．arg1 は CPU の番号． */
+    SYSCALL(GetCPUUsage){
+        const uint64_t cpu = arg1;
+        if(cpu >= kNumCPUs){
+            return { 0, EINVAL };
+        }
+        return { BusyPermille(cpu), 0 };
+    }
+
+    /** @brief 現在のタスクを実行してよい CPU の集合を記録し，それまでの集合を返す．
+     * arg1 のビット i が CPU i．アプリの終了時に元の集合に戻る．
+     * CPU は 1 つしか動かしていないので，今は記録するだけで何も変わらない． */
+    SYSCALL(SetAffinity){
+        const CPUMask mask = arg1;
+        const auto rflags = SaveAndDisableInterrupts();
+        auto& task = task_manager->CurrentTask();
+        const CPUMask old_mask = task.Affinity();
+        auto err = task_manager->SetAffinity(&task, mask);
+        RestoreInterrupts(rflags);
+        if(err){
+            return { 0, EINVAL };
+        }
+        return { old_mask, 0 };
+    }
+
+    /** @brief ウィンドウの画素をアプリのアドレス空間にマップし，その情報を arg2 に書く．
+     *
+     * アプリが直接書き込んだ結果は WinDamage で知らせるまで画面に出ない．
+     * マップはアプリが終了するまで有効で，その間はウィンドウを閉じても画素は解放しない．
+     */
+    namespace {
+        /** @brief layer_id が今のアプリ（同じアドレス空間のスレッドを含む）が OpenWindow で
+         * 開いたレイヤならそのウィンドウを，そうでなければ nullptr を返す．
+         *
+         * アプリはターミナルのタスクで動くので，layer_task_map の持ち主だけでは
+         * ターミナル自身のウィンドウと区別できない．そのため開いたレイヤの記録も調べる．
+         */
+        std::shared_ptr<Window> FindOwnWindow(unsigned int layer_id){
+            const auto rflags = SaveAndDisableInterrupts();
+            auto& task = task_manager->CurrentTask();
+            bool owned = false;
+            if(auto it = layer_task_map->find(layer_id); it != layer_task_map->end()){
+                owned = task_manager->SharesSpace(it->second, task);
+            }
+            RestoreInterrupts(rflags);
+
+            if(!owned){
+                return nullptr;
+            }
+            {
+                // 他のスレッドの OpenWindow が windows を伸ばしている最中に読まない
+                LockGuard space_lock{task.Space().lock};
+                const auto& windows = task.Space().windows;
+                if(std::find(windows.begin(), windows.end(), layer_id) == windows.end()){
+                    return nullptr;
+                }
+            }
+
+            LockGuard lock{layer_manager->GetLock()};
+            if(auto layer = layer_manager->FindLayer(layer_id)){
+                return layer->GetWindow();
+            }
+            return nullptr;
+        }
+    }
+
+    SYSCALL(MapWindow){
+        const unsigned int layer_id = arg1 & 0xffffffff;
+        const auto surface = reinterpret_cast<WindowSurface*>(arg2);
+        if(arg2 < 0x8000'0000'0000'0000){
+            return { 0, EFAULT };
+        }
+
+        auto window = FindOwnWindow(layer_id);
+        if(!window){
+            return { 0, EBADF };
+        }
+
+        auto& buffer = window->Buffer();
+        const size_t num_pages = buffer.NumFrames();
+        if(num_pages == 0){
+            return { 0, EINVAL };
+        }
+        const auto phys_begin = reinterpret_cast<uint64_t>(buffer.Row(0));
+
+        auto rflags = SaveAndDisableInterrupts();
+        auto& task = task_manager->CurrentTask();
+        RestoreInterrupts(rflags);
+
+        uint64_t vaddr_begin;
+        {
+            LockGuard space_lock{task.Space().lock};
+            // マップに失敗しても途中までのページは終了時まで残るので，先にウィンドウを持っておく
+            task.MappedWindows().push_back(window);
+            rflags = SaveAndDisableInterrupts();
+            vaddr_begin = task.FileMapEnd() - num_pages * kBytesPerFrame;
+            task.SetFileMapEnd(vaddr_begin);
+            RestoreInterrupts(rflags);
+            for(size_t i = 0; i < num_pages; ++i){
+                // ページテーブルはページフォールトの処理も書き換えるので，1 ページずつ割り込みを禁止する
+                const uint64_t offset = i * kBytesPerFrame;
+                rflags = SaveAndDisableInterrupts();
+                auto err = MapSharedPage(LinearAddress4Level{vaddr_begin + offset},
+                                         phys_begin + offset);
+                RestoreInterrupts(rflags);
+                if(err){
+                    return { 0, ENOMEM };
+                }
+            }
+        }
+
+        const auto& config = buffer.Config();
+        surface->pixels = reinterpret_cast<uint32_t*>(vaddr_begin);
+        surface->width = config.horizontal_resolution;
+        surface->height = config.vertical_resolution;
+        surface->stride = config.pixels_per_scan_line;
+        surface->format = config.pixel_format;
+        return { vaddr_begin, 0 };
+    }
+
+    /** @brief ウィンドウの (x, y, w, h) を書き換えたことを知らせ，次のフレームで画面に反映させる． */
+    SYSCALL(WinDamage){
+        const unsigned int layer_id = arg1 & 0xffffffff;
+        const int x = arg2, y = arg3, w = arg4, h = arg5;
+        if(w <= 0 || h <= 0){
+            return { 0, EINVAL };
+        }
+        const auto window = FindOwnWindow(layer_id);
+        if(!window){
+            return { 0, EBADF };
+        }
+
+        // x + w があふれないよう 64 ビットで計算してウィンドウの中に切り詰める
+        const auto size = window->Size();
+        const int64_t x0 = std::max<int64_t>(x, 0), y0 = std::max<int64_t>(y, 0);
+        const int64_t x1 = std::min<int64_t>(int64_t{x} + w, size.x);
+        const int64_t y1 = std::min<int64_t>(int64_t{y} + h, size.y);
+        if(x0 >= x1 || y0 >= y1){
+            return { 0, 0 };
+        }
+        layer_manager->AddDamage(layer_id, {{static_cast<int>(x0), static_cast<int>(y0)},
+                                            {static_cast<int>(x1 - x0), static_cast<int>(y1 - y0)}});
+        return { 0, 0 };
+    }
 #undef SYSCALL
 }
 
 using SyscallFuncType = syscall::Result (uint64_t, uint64_t, uint64_t,
                                          uint64_t, uint64_t, uint64_t);
 
-extern "C" std::array<SyscallFuncType*, 0x10> syscall_table{
+extern "C" std::array<SyscallFuncType*, 0x1b> syscall_table{
     /* 0x00 */  syscall::LogString,
     /* 0x01 */  syscall::PutString,
     /* 0x02 */  syscall::Exit,
@@ -421,6 +855,17 @@ extern "C" std::array<SyscallFuncType*, 0x10> syscall_table{
     /* 0x0d */  syscall::ReadFile,
     /* 0x0e */  syscall::DemandPages,
     /* 0x0f */  syscall::MapFile,
+    /* 0x10 */  syscall::GetTimeNs,
+    /* 0x11 */  syscall::SetNice,
+    /* 0x12 */  syscall::FutexWait,
+    /* 0x13 */  syscall::FutexWake,
+    /* 0x14 */  syscall::CreateThread,
+    /* 0x15 */  syscall::JoinThread,
+    /* 0x16 */  syscall::GetCPUUsage,
+    /* 0x17 */  syscall::SetAffinity,
+    /* 0x18 */  syscall::MapWindow,
+    /* 0x19 */  syscall::WinDamage,
+    /* 0x1a */  syscall::WinDrawBatch,
 };
 
 void InitializeSyscall() {
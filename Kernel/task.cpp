@@ -1,8 +1,15 @@
 #include "task.hpp"
 
 #include <algorithm>
+#include <cstddef>
 #include <cstring>
+#include <limits>
 #include "asmfunc.h"
+#include "boot_option.hpp"
+#include "fpu.hpp"
+#include "idle.hpp"
+#include "interrupt.hpp"
+#include "logger.hpp"
 #include "segment.hpp"
 #include "timer.hpp"
 
@@ -13,19 +20,41 @@ namespace {
         c.erase(it, c.end());
     }
 
-    void TaskIdle(uint64_t task_id, int64_t data){
-        while(true) __asm__("hlt");
-    }
+    /** @brief nice = 0 の重み．nice が 1 違うと重みが約 1.25 倍違う． */
+    const uint64_t kNice0Weight = 1024;
+    const std::array<uint64_t, 40> kNiceToWeight{
+        /* -20 */ 88761, 71755, 56483, 46273, 36291,
+        /* -15 */ 29154, 23254, 18705, 14949, 11916,
+        /* -10 */  9548,  7620,  6100,  4904,  3906,
+        /*  -5 */  3121,  2501,  1991,  1586,  1277,
+        /*   0 */  1024,   820,   655,   526,   423,
+        /*   5 */   335,   272,   215,   172,   137,
+        /*  10 */   110,    87,    70,    56,    45,
+        /*  15 */    36,    29,    23,    18,    15,
+    };
+
+    /** @brief 起こされたタスクの vruntime を min_vruntime_ からこれだけ手前まで戻す．
+     * 長く眠っていた対話的なタスクがすぐに選ばれるようにするため． */
+    const uint64_t kSleeperCreditNs = 10'000'000;
 } // namespace
 
-Task::Task(uint64_t id) : id_{id}, msgs_{} {
+Task::Task(uint64_t id) : id_{id}, msgs_{}, space_{std::make_shared<AddressSpace>()} {
+    fpu_buf_.resize(FPUStateBytes() + kFPUStateAlign);
+    const auto buf_addr = reinterpret_cast<uintptr_t>(fpu_buf_.data());
+    fpu_state_ = reinterpret_cast<uint8_t*>(
+        (buf_addr + kFPUStateAlign - 1) & ~(kFPUStateAlign - 1));
+    InitFPUState(fpu_state_);
+}
 
+Task::~Task() {
+    if(stack_end_ != 0){
+        FreeKernelStack(stack_end_);
+    }
 }
 
 Task& Task::InitContext(TaskFunc* f, int64_t data) {
-    const size_t stack_size = kDefaultStackBytes / sizeof(stack_[0]);
-    stack_.resize(stack_size);
-    uint64_t stack_end = reinterpret_cast<uint64_t>(&stack_[stack_size]);
+    // 最上位の 8 バイトは戻り先の位置なので使われない．FreeKernelStack がそこを使う
+    const uint64_t stack_end = stack_end_;
 
     memset(&context_, 0, sizeof(context_));
     context_.cr3 = GetCR3();
@@ -38,11 +67,31 @@ Task& Task::InitContext(TaskFunc* f, int64_t data) {
     context_.rdi = id_;
     context_.rsi = data;
 
-    *reinterpret_cast<uint32_t*>(&context_.fxsave_area[24]) = 0x1f80;
-
     return *this;
 }
 
+void Task::Release() {
+    msgs_.clear();
+    ResetSpace();
+}
+
+void Task::Reuse(uint64_t id) {
+    id_ = id;
+    os_stack_ptr_ = 0;
+    level_ = kDefaultLevel;
+    running_ = false;
+    state_ = TaskState::kAlive;
+    vruntime_ = 0;
+    exec_start_ns_ = 0;
+    nice_ = 0;
+    wakeup_ns_ = 0;
+    slice_start_ns_ = 0;
+    voluntary_switches_ = 0;
+    involuntary_switches_ = 0;
+    finish_waited_ = 0;
+    InitFPUState(fpu_state_);
+}
+
 TaskContext& Task::Context() {
     return context_;
 }
@@ -66,7 +115,21 @@ Task& Task::Wakeup() {
 
 void Task::SendMessage(const Message& msg){
     msgs_.push_back(msg);
-  Wakeup();
+    if(msg_waiters_.Empty()){
+        Wakeup();
+    } else {
+        msg_waiters_.WakeupAll();
+    }
+}
+
+Message Task::WaitMessage(){
+    while(msgs_.empty()){
+        msg_waiters_.Wait();
+    }
+
+    auto m = msgs_.front();
+    msgs_.pop_front();
+    return m;
 }
 
 std::optional<Message> Task::ReceiveMessage(){
@@ -80,61 +143,188 @@ std::optional<Message> Task::ReceiveMessage(){
 }
 
 std::vector<std::shared_ptr<::FileDescriptor>>& Task::Files(){
-    return files_;
+    return space_->files;
 }
 
 uint64_t Task::DPagingBegin() const {
-    return dpaging_begin_;
+    return space_->dpaging_begin;
 }
 
 void Task::SetDPagingBegin(uint64_t v){
-    dpaging_begin_ = v;
+    space_->dpaging_begin = v;
 }
 
 uint64_t Task::DPagingEnd() const {
-    return dpaging_end_;
+    return space_->dpaging_end;
 }
 
 void Task::SetDPagingEnd(uint64_t v){
-    dpaging_end_ = v;
+    space_->dpaging_end = v;
 }
 
 uint64_t Task::FileMapEnd() const {
-    return file_map_end_;
+    return space_->file_map_end;
 }
 
 void Task::SetFileMapEnd(uint64_t v) {
-    file_map_end_ = v;
+    space_->file_map_end = v;
 }
 
 std::vector<FileMapping>& Task::FileMaps() {
-    return file_maps_;
+    return space_->file_maps;
+}
+
+std::vector<std::shared_ptr<Window>>& Task::MappedWindows() {
+    return space_->mapped_windows;
+}
+
+Task& Task::ShareSpace(Task& other) {
+    space_ = other.space_;
+    return *this;
+}
+
+std::shared_ptr<AddressSpace> Task::ResetSpace() {
+    auto old_space = std::move(space_);
+    space_ = std::make_shared<AddressSpace>();
+    return old_space;
 }
 
-TaskManager::TaskManager() {
-    Task& task = NewTask()
-        .SetLevel(current_level_)
+AddressSpace::~AddressSpace() {
+    if(pml4 == nullptr){
+        return;
+    }
+    if(auto err = CleanPageMaps(pml4, LinearAddress4Level{0xffff'8000'0000'0000})){
+        Log(kError, "failed to clean page maps: %s\n", err.Name());
+    }
+    if(auto err = FreePageMap(pml4)){
+        Log(kError, "failed to free PML4: %s\n", err.Name());
+    }
+}
+
+TaskManager::TaskManager(SchedulerClass sched_class) : sched_class_{sched_class} {
+    auto [main_task, main_err] = NewTask();
+    auto [idle_task, idle_err] = NewTask();
+    if(main_err || idle_err){
+        Log(kError, "failed to create initial tasks: %s\n",
+            (main_err ? main_err : idle_err).Name());
+        while(true) __asm__("hlt");
+    }
+
+    Task& task = main_task->SetLevel(current_level_)
         .SetRunning(true);
     running_[current_level_].push_back(&task);
+    fpu_owner_ = &task;
+    fair_current_ = &task;
+    task.exec_start_ns_ = timer_manager->CurrentTimeNs();
+    task.slice_start_ns_ = task.exec_start_ns_;
+    task.affinity_ = OnlineCPUs();
 
-    Task& idle = NewTask()
-        .InitContext(TaskIdle, 0)
+    Task& idle = idle_task->InitContext(TaskIdle, 0)
         .SetLevel(0)
         .SetRunning(true);
     running_[0].push_back(&idle);
+    idle_task_ = &idle;
 }
 
-Task& TaskManager::NewTask() {
+WithError<Task*> TaskManager::NewTask() {
+    ReapZombies();
+
+    const auto rflags = SaveAndDisableInterrupts();
+    std::unique_ptr<Task> new_task;
+    if(free_tasks_.empty()){
+        new_task.reset(new Task{latest_id_ + 1});
+    } else {
+        new_task = std::move(free_tasks_.back());
+        free_tasks_.pop_back();
+        new_task->Reuse(latest_id_ + 1);
+    }
+    // 使い回すタスクはカーネルスタックを持ったままなので，割り当てに失敗するのは新しいタスクだけ
+    if(new_task->stack_end_ == 0){
+        auto [stack_end, err] = AllocateKernelStack();
+        if(err){
+            RestoreInterrupts(rflags);
+            return {nullptr, err};
+        }
+        new_task->stack_end_ = stack_end;
+    }
+
     ++latest_id_;
-    return *tasks_.emplace_back(new Task {latest_id_});
+    Task& task = *new_task;
+    tasks_.emplace(latest_id_, std::move(new_task));
+    task.vruntime_ = min_vruntime_;
+    task.affinity_ = OnlineCPUs();
+    RestoreInterrupts(rflags);
+    return {&task, MAKE_ERROR(Error::kSuccess)};
+}
+
+Task* TaskManager::FindTask(uint64_t id) {
+    auto it = tasks_.find(id);
+    if(it == tasks_.end()){
+        return nullptr;
+    }
+    return it->second.get();
+}
+
+bool TaskManager::SharesSpace(uint64_t id, Task& task) {
+    Task* other = FindTask(id);
+    return other != nullptr && &other->Space() == &task.Space();
+}
+
+void TaskManager::DropExitStatuses() {
+    auto it = finish_order_.begin();
+    while(finish_tasks_.size() > kMaxExitStatuses && it != finish_order_.end()){
+        if(finish_tasks_.find(*it)->second.waited > 0){
+            ++it;
+            continue;
+        }
+        finish_tasks_.erase(*it);
+        it = finish_order_.erase(it);
+    }
+}
+
+void TaskManager::ReapZombies() {
+    std::vector<std::unique_ptr<Task>> zombies;
+    auto rflags = SaveAndDisableInterrupts();
+    zombies.swap(zombies_);
+    RestoreInterrupts(rflags);
+    if(zombies.empty()){
+        return;
+    }
+
+    // ページテーブルやファイルの解放は時間がかかるので，割り込みを許可して行う
+    for(auto& task : zombies){
+        task->Release();
+    }
+
+    rflags = SaveAndDisableInterrupts();
+    for(auto& task : zombies){
+        if(free_tasks_.size() < kMaxFreeTasks){
+            task->state_ = TaskState::kFree;
+            free_tasks_.push_back(std::move(task));
+        }
+    }
+    RestoreInterrupts(rflags);
+    // 取っておけない分はここで破棄され，カーネルスタックはプールに戻る
+    zombies.clear();
+
+    // Finish で確保し直さなくて済むよう，空いた領域を zombies_ に返す
+    rflags = SaveAndDisableInterrupts();
+    if(zombies_.empty()){
+        zombies_.swap(zombies);
+    }
+    RestoreInterrupts(rflags);
 }
 
 
 void TaskManager::SwitchTask(const TaskContext& current_ctx) {
     TaskContext& task_ctx = task_manager->CurrentTask().Context();
-    memcpy(&task_ctx, &current_ctx, sizeof(TaskContext));
+    memcpy(&task_ctx, &current_ctx, offsetof(TaskContext, fxsave_area));
     Task* current_task = RotateCurrentRunQueue(false);
     if(&CurrentTask() != current_task){
+        AccountSwitch(current_task, &CurrentTask(), false);
+        // 割り込み処理で上書きされた FPU レジスタを fpu_owner_ の状態に戻しておく
+        RestoreFXSaveArea(current_ctx.fxsave_area.data());
+        SetFPUTrap(&CurrentTask() != fpu_owner_);
         RestoreContext(&CurrentTask().Context());
     }
 }
@@ -147,113 +337,191 @@ void TaskManager::Sleep(Task* task) {
 
     task->SetRunning(false);
 
-    if(task == running_[current_level_].front()){
+    if(task == &CurrentTask()){
         Task* current_task = RotateCurrentRunQueue(true);
+        AccountSwitch(current_task, &CurrentTask(), true);
+        if(IsIdle()){
+            timer_manager->ProgramNextEvent();
+        }
+        SetFPUTrap(&CurrentTask() != fpu_owner_);
         SwitchContext(&CurrentTask().Context(), &current_task->Context());
         return;
     }
 
+    if(sched_class_ == SchedulerClass::kFair){
+        fair_queue_.erase(task);
+        return;
+    }
     Erase(running_[task->Level()], task);
 }
 
 Error TaskManager::Sleep(uint64_t id){
-    auto it = std::find_if(tasks_.begin(), tasks_.end(), 
-                        [id](const auto& t){ return t->ID() == id; });
-    if ( it == tasks_.end()){
+    Task* task = FindTask(id);
+    if (task == nullptr){
         return MAKE_ERROR(Error::kNoSuchTask);
     }
 
-    Sleep(it->get());
+    Sleep(task);
     return MAKE_ERROR(Error::kSuccess);
 }
 
 void TaskManager::Wakeup(Task* task, int level) {
-    if(task->Running()){
-        ChangeLevelRunning(task, level);
-        return;
+    const bool was_idle = IsIdle();
+    MakeRunnable(task, level);
+    if(was_idle){
+        // tickless で眠っている間はタスク切り替え用タイマが止まっているので，
+        // 起こしたタスクに早く切り替わるようにタイマをプログラムし直す。
+        timer_manager->ProgramNextEvent();
     }
+}
 
-    if (level < 0){
-        level = task->Level();
+/** @brief 複数のタスクをまとめて起こす．タイマの再設定は 1 回で済ませる． */
+void TaskManager::Wakeup(Task* const* tasks, size_t n) {
+    const bool was_idle = IsIdle();
+    for(size_t i = 0; i < n; ++i){
+        MakeRunnable(tasks[i], -1);
     }
-
-    task->SetLevel(level);
-    task->SetRunning(true);
-
-    running_[level].push_back(task);
-    if(level > current_level_){
-        level_changed_ = true;
+    if(was_idle && n > 0){
+        timer_manager->ProgramNextEvent();
     }
-    return;
 }
 
 Error TaskManager::Wakeup(uint64_t id, int level) {
-    auto it = std::find_if(tasks_.begin(), tasks_.end(), 
-                        [id](const auto& t){ return t->ID() == id; });
-    if ( it == tasks_.end()){
+    Task* task = FindTask(id);
+    if (task == nullptr){
         return MAKE_ERROR(Error::kNoSuchTask);
     }
 
-  Wakeup(it->get(), level);
+    Wakeup(task, level);
     return MAKE_ERROR(Error::kSuccess);
 }
 
-Error TaskManager::SendMessage(uint64_t id, const Message& msg){    
-    auto it = std::find_if(tasks_.begin(), tasks_.end(), 
-                            [id](const auto& t){ return t->ID() == id; });
-    
-    if( it == tasks_.end() ){
+Error TaskManager::SendMessage(uint64_t id, const Message& msg){
+    Task* task = FindTask(id);
+    if( task == nullptr ){
         return MAKE_ERROR(Error::kNoSuchTask);
     }
 
-    (*it)->SendMessage(msg);
+    task->SendMessage(msg);
     return MAKE_ERROR(Error::kSuccess);
 }
 
+void TaskManager::MakeRunnable(Task* task, int level) {
+    if(task->State() != TaskState::kAlive){
+        return;
+    }
+    if(task->Running()){
+        ChangeLevelRunning(task, level);
+        return;
+    }
+
+    if (level < 0){
+        level = task->Level();
+    }
+
+    task->SetLevel(level);
+    task->SetRunning(true);
+    task->wakeup_ns_ = timer_manager->CurrentTimeNs();
+
+    if(sched_class_ == SchedulerClass::kFair){
+        if(min_vruntime_ > kSleeperCreditNs){
+            task->vruntime_ = std::max(task->vruntime_, min_vruntime_ - kSleeperCreditNs);
+        }
+        fair_queue_.insert(task);
+        return;
+    }
+
+    running_[level].push_back(task);
+    if(level > current_level_){
+        level_changed_ = true;
+    }
+}
+
 Task& TaskManager::CurrentTask() {
+    if(sched_class_ == SchedulerClass::kFair){
+        return *fair_current_;
+    }
     return *running_[current_level_].front();
 }
 
 void TaskManager::Finish(int exit_code) {
     Task* current_task = RotateCurrentRunQueue(true);
+    AccountSwitch(current_task, &CurrentTask(), true);
 
     const auto task_id = current_task->ID();
-    auto it = std::find_if(
-        tasks_.begin(), tasks_.end(),
-        [current_task](const auto& t) {return t.get() == current_task; }
-    );
+    auto it = tasks_.find(task_id);
+    // まだこのタスクのスタックの上で動いているので，資源の回収は後で ReapZombies が行う
+    current_task->state_ = TaskState::kZombie;
+    zombies_.push_back(std::move(it->second));
     tasks_.erase(it);
 
-    finish_tasks_[task_id] = exit_code;
-    if(auto it = finish_waiter_.find(task_id); it != finish_waiter_.end()){
-        auto waiter = it->second;
-        finish_waiter_.erase(it);
-        Wakeup(waiter);
-    }
+    finish_tasks_[task_id] = {exit_code, current_task->finish_waited_};
+    finish_order_.push_back(task_id);
+    DropExitStatuses();
+    finish_waiters_.WakeupAll();
 
+    if(fpu_owner_ == current_task){
+        fpu_owner_ = nullptr;
+    }
+    SetFPUTrap(&CurrentTask() != fpu_owner_);
     RestoreContext(&CurrentTask().Context());
 }
 
 WithError<int> TaskManager::WaitFinish(uint64_t task_id){
-    int exit_code;
-    Task* current_task = &CurrentTask();
-    while (true){
-        if(auto it = finish_tasks_.find(task_id); it != finish_tasks_.end()){
-            exit_code = it->second;
-            finish_tasks_.erase(it);
-            break;
+    const auto rflags = SaveAndDisableInterrupts();
+    auto it = finish_tasks_.find(task_id);
+    if(it == finish_tasks_.end()){
+        Task* task = FindTask(task_id);
+        if(task == nullptr){
+            RestoreInterrupts(rflags);
+            return {0, MAKE_ERROR(Error::kNoSuchTask)};  // 存在しないか，終了コードを捨てた後
+        }
+        // 待っている間は終了コードを捨てさせない．数は Finish が終了コードと一緒に記録する．
+        // 終了コードは最初に起きた 1 つが受け取って消すので，数を減らす必要はない
+        ++task->finish_waited_;
+        while (it == finish_tasks_.end() && FindTask(task_id) != nullptr){
+            finish_waiters_.Wait();
+            it = finish_tasks_.find(task_id);
+        }
+        if(it == finish_tasks_.end()){
+            RestoreInterrupts(rflags);
+            return {0, MAKE_ERROR(Error::kNoSuchTask)};
         }
-        finish_waiter_[task_id] = current_task;
-        Sleep(current_task);
     }
+    const int exit_code = it->second.exit_code;
+    finish_tasks_.erase(it);
+    finish_order_.erase(std::find(finish_order_.begin(), finish_order_.end(), task_id));
+    RestoreInterrupts(rflags);
+
+    ReapZombies();
     return {exit_code, MAKE_ERROR(Error::kSuccess)};
 }
 
+bool TaskManager::IsIdle() const {
+    if(sched_class_ == SchedulerClass::kFair){
+        return fair_queue_.empty() && fair_current_ == idle_task_;
+    }
+
+    for(int lv = kMaxLevel; lv >= 0; --lv){
+        for(Task* task : running_[lv]){
+            if(task != idle_task_){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 void TaskManager::ChangeLevelRunning(Task* task, int level) {
     if (level < 0 || level == task->Level()){
         return;
     }
 
+    if (sched_class_ == SchedulerClass::kFair){
+        task->SetLevel(level);
+        return;
+    }
+
     if (task != running_[current_level_].front()){
         Erase(running_[task->Level()], task);
         running_[level].push_back(task);
@@ -276,6 +544,10 @@ void TaskManager::ChangeLevelRunning(Task* task, int level) {
 }
 
 Task* TaskManager::RotateCurrentRunQueue(bool current_sleep){
+    if(sched_class_ == SchedulerClass::kFair){
+        return RotateFairQueue(current_sleep);
+    }
+
     auto& level_queue = running_[current_level_];
     Task* current_task = level_queue.front();
     level_queue.pop_front();
@@ -299,15 +571,160 @@ Task* TaskManager::RotateCurrentRunQueue(bool current_sleep){
     return current_task;
 }
 
+/**
+ * @brief 実行中のタスクを実行待ちに戻し，vruntime が最小のタスクを次に実行する．
+ *
+ * 実行待ちのタスクが無ければアイドルタスクを実行する．
+ * @return それまで実行していたタスク
+ */
+Task* TaskManager::RotateFairQueue(bool current_sleep){
+    Task* current_task = fair_current_;
+    const auto now = timer_manager->CurrentTimeNs();
+    UpdateVRuntime(current_task, now);
+    if(!current_sleep && current_task != idle_task_){
+        fair_queue_.insert(current_task);
+    }
+
+    if(fair_queue_.empty()){
+        fair_current_ = idle_task_;
+    } else {
+        fair_current_ = *fair_queue_.begin();
+        fair_queue_.erase(fair_queue_.begin());
+    }
+    fair_current_->exec_start_ns_ = now;
+    UpdateMinVRuntime();
+    return current_task;
+}
+
+/** @brief 前回からの実行時間を nice に応じた重みで割って vruntime に加える． */
+void TaskManager::UpdateVRuntime(Task* task, uint64_t now_ns){
+    if(task == idle_task_ || now_ns <= task->exec_start_ns_){
+        return;
+    }
+    const uint64_t delta_ns = now_ns - task->exec_start_ns_;
+    const uint64_t weight = kNiceToWeight[task->nice_ - kMinNice];
+    task->vruntime_ += delta_ns * kNice0Weight / weight;
+    task->exec_start_ns_ = now_ns;
+}
+
+void TaskManager::UpdateMinVRuntime(){
+    uint64_t v = std::numeric_limits<uint64_t>::max();
+    if(fair_current_ != idle_task_){
+        v = fair_current_->vruntime_;
+    }
+    if(!fair_queue_.empty()){
+        v = std::min(v, (*fair_queue_.begin())->vruntime_);
+    }
+    if(v != std::numeric_limits<uint64_t>::max()){
+        min_vruntime_ = std::max(min_vruntime_, v);
+    }
+}
+
+Error TaskManager::SetNice(Task* task, int nice){
+    if(nice < kMinNice || kMaxNice < nice){
+        return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+
+    if(task == fair_current_){
+        // それまでの実行時間は古い重みで数える
+        UpdateVRuntime(task, timer_manager->CurrentTimeNs());
+    }
+    task->nice_ = nice;
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+/** @brief prev から next への切り替えを統計に数える．
+ *
+ * prev のタイムスライスの長さと，next が起こされてから実行されるまでの時間を
+ * それぞれのレベルのヒストグラムに加える．アイドルタスクのスライスは数えない．
+ */
+void TaskManager::AccountSwitch(Task* prev, Task* next, bool voluntary){
+    // 切り替え先のタスクで割り込みを許可しても，それは prev の区間の終わりではない
+    irq_off_stat.since = 0;
+    const auto now = timer_manager->CurrentTimeNs();
+    if(prev != idle_task_){
+        level_stats_[prev->Level()].slice.Add(now - prev->slice_start_ns_);
+    }
+    if(voluntary){
+        ++prev->voluntary_switches_;
+    } else {
+        ++prev->involuntary_switches_;
+    }
+
+    if(next->wakeup_ns_ != 0){
+        level_stats_[next->Level()].wakeup_latency.Add(now - next->wakeup_ns_);
+        next->wakeup_ns_ = 0;
+    }
+    next->slice_start_ns_ = now;
+}
+
+void TaskManager::GetSchedStats(std::array<SchedLevelStats, kMaxLevel + 1>& levels,
+                                std::vector<TaskSchedStat>& tasks) const {
+    levels = level_stats_;
+    tasks.clear();
+    tasks.reserve(tasks_.size());
+    for(const auto& [id, t] : tasks_){
+        tasks.push_back({t->ID(), t->Level(),
+                         t->voluntary_switches_, t->involuntary_switches_});
+    }
+}
+
+void TaskManager::ResetSchedStats(){
+    for(auto& stats : level_stats_){
+        stats.wakeup_latency.Clear();
+        stats.slice.Clear();
+    }
+    for(auto& [id, t] : tasks_){
+        t->voluntary_switches_ = 0;
+        t->involuntary_switches_ = 0;
+    }
+}
+
+CPUMask TaskManager::OnlineCPUs() {
+    return kNumCPUs >= 64 ? ~CPUMask{0} : (CPUMask{1} << kNumCPUs) - 1;
+}
+
+Error TaskManager::SetAffinity(Task* task, CPUMask mask){
+    mask &= OnlineCPUs();
+    if(mask == 0){
+        return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+    task->affinity_ = mask;
+    return MAKE_ERROR(Error::kSuccess);
+}
+
 TaskManager* task_manager;
 
+void TaskManager::SwitchFPU() {
+    SetFPUTrap(false);
+    Task* current_task = &CurrentTask();
+    if(fpu_owner_ == current_task){
+        return;
+    }
+
+    if(fpu_owner_){
+        SaveFPUState(fpu_owner_->FPUState());
+    }
+    RestoreFPUState(current_task->FPUState());
+    fpu_owner_ = current_task;
+}
+
 void InitializeTask() {
-    task_manager = new TaskManager;
+    const char* scheduler = BootOption("scheduler", "priority");
+    auto sched_class = SchedulerClass::kPriority;
+    if(strcmp(scheduler, "fair") == 0){
+        sched_class = SchedulerClass::kFair;
+    } else if(strcmp(scheduler, "priority") != 0){
+        Log(kWarn, "unknown scheduler '%s', using priority\n", scheduler);
+    }
+    task_manager = new TaskManager(sched_class);
+    Log(kInfo, "scheduler: %s\n",
+        sched_class == SchedulerClass::kFair ? "fair" : "priority");
 
-    __asm__("cli");
+    DisableInterrupts();
     timer_manager->AddTimer(
         Timer{timer_manager->CurrentTick() + kTaskTimerPeriod, kTaskTimerValue, 1});
-    __asm__("sti");
+    EnableInterrupts();
 }
 
 __attribute__((no_caller_saved_registers))
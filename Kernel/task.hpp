@@ -8,35 +8,88 @@
 #include <memory>
 #include <optional>
 #include <map>
+#include <set>
 
 #include "error.hpp"
 #include "message.hpp"
 #include "paging.hpp"
 #include "fat.hpp"
+#include "kernel_stack.hpp"
+#include "sched_stat.hpp"
+#include "wait_queue.hpp"
 
 struct TaskContext {
   uint64_t cr3, rip, rflags, reserved1; // offset 0x00
   uint64_t cs, ss, fs, gs; // offset 0x20
   uint64_t rax, rbx, rcx, rdx, rdi, rsi, rsp, rbp; // offset 0x40
   uint64_t r8, r9, r10, r11, r12, r13, r14, r15; // offset 0x80
-  std::array<uint8_t, 512> fxsave_area; // offset 0xc0
+  std::array<uint8_t, 512> fxsave_area; // offset 0xc0 割り込み時の FPU レジスタの退避先
 } __attribute__((packed));
 
 using TaskFunc = void (uint64_t, int64_t);
 
+/** @brief タスクを実行してよい CPU の集合．ビット i が CPU i を表す． */
+using CPUMask = uint64_t;
+
 class TaskManager;
+class Window;
 
 struct FileMapping {
     int fd;
     uint64_t vaddr_begin, vaddr_end;
 };
 
+/** @brief アプリのアドレス空間と，それを共有するスレッドに共通の資源．
+ *
+ * 同じアプリのスレッドは 1 つの AddressSpace を shared_ptr で共有し，
+ * 最後のスレッドが手放したときにページテーブルを解放する．
+ */
+struct AddressSpace {
+    ~AddressSpace();
+
+    /** @brief アプリの PML4．nullptr ならカーネルのページテーブルを使う． */
+    PageMapEntry* pml4{nullptr};
+    std::vector<std::shared_ptr<::FileDescriptor>> files{};
+    uint64_t dpaging_begin{0};
+    uint64_t dpaging_end{0};
+    uint64_t file_map_end{0};
+    std::vector<FileMapping> file_maps{};
+    /** @brief MapWindow でアプリにマップしたウィンドウ．
+     * アドレス空間を解放するまでウィンドウの画素を解放させないために持つ． */
+    std::vector<std::shared_ptr<Window>> mapped_windows{};
+    /** @brief OpenWindow で開いたレイヤの ID．MapWindow と WinDamage はこれに含まれるものだけを受け付ける． */
+    std::vector<unsigned int> windows{};
+    /** @brief CreateThread で作られ，まだ JoinThread されていないスレッドの ID． */
+    std::vector<uint64_t> threads{};
+
+    /** @brief 同じアドレス空間のスレッドが同時にアドレスの範囲（dpaging_end, file_map_end,
+     * file_maps）を割り当てたり，mapped_windows, windows を書き換えたりしないようにする．
+     *
+     * ページフォールトの処理はこれを取らずに dpaging_end, file_maps とページテーブルを
+     * 読み書きするので，それらを書き換える間は割り込みも禁止すること．
+     */
+    Mutex lock{};
+};
+
+/** @brief タスクオブジェクトの状態． */
+enum class TaskState {
+    /** @brief 実行中，実行待ち，または眠っている． */
+    kAlive,
+    /** @brief Finish を呼んで終了し，資源の回収を待っている． */
+    kZombie,
+    /** @brief 資源を回収済みで，NewTask で使い回されるのを待っている． */
+    kFree,
+};
+
 class Task {
     public:
         static const int kDefaultLevel = 1;
-        static const size_t kDefaultStackBytes = 8 * 4096;
+        static const size_t kDefaultStackBytes = kKernelStackBytes;
 
         Task(uint64_t id);
+        ~Task();
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
         Task& InitContext(TaskFunc* f, int64_t data);
         TaskContext& Context();
         uint64_t& OSStackPointer();
@@ -45,6 +98,8 @@ class Task {
         Task& Wakeup();
         void SendMessage(const Message& msg);
         std::optional<Message> ReceiveMessage();
+        /** @brief メッセージが届くまで眠って待つ．割り込みを禁止した状態で呼ぶ． */
+        Message WaitMessage();
         std::vector<std::shared_ptr<::FileDescriptor>>& Files();
         uint64_t DPagingBegin() const;
         void SetDPagingBegin(uint64_t v);
@@ -53,58 +108,174 @@ class Task {
         uint64_t FileMapEnd() const;
         void SetFileMapEnd(uint64_t v);
         std::vector<FileMapping>& FileMaps();
+        std::vector<std::shared_ptr<Window>>& MappedWindows();
+        AddressSpace& Space() { return *space_; }
+        /** @brief other と同じアドレス空間を使うようにする（スレッドの作成）． */
+        Task& ShareSpace(Task& other);
+        /** @brief アドレス空間を新しい空のものにし，古いものを返す．
+         * 他に共有しているタスクが無ければ，返した shared_ptr を手放したときにページテーブルなどが
+         * 解放される．時間がかかるので，割り込みを許可してから手放すこと．
+         * 手放すアドレス空間の PML4 を CR3 に設定したまま呼ばないこと． */
+        std::shared_ptr<AddressSpace> ResetSpace();
+        /** @brief FPU/SSE/AVX の状態の保存領域．FPU の持ち主でない間だけ有効． */
+        uint8_t* FPUState() { return fpu_state_; }
 
         int Level() const { return level_; }
         bool Running() const { return running_; }
+        TaskState State() const { return state_; }
+        CPUMask Affinity() const { return affinity_; }
+        int Nice() const { return nice_; }
+        uint64_t VRuntime() const { return vruntime_; }
     private:
         uint64_t id_;
-        std::vector<uint64_t> stack_;
+        /** @brief カーネルスタックプールから借りたスタックの終端．借りていなければ 0． */
+        uint64_t stack_end_{0};
         alignas(16) TaskContext context_;
         uint64_t os_stack_ptr_;
         std::deque<Message> msgs_;
+        WaitQueue msg_waiters_{};
         unsigned int level_{kDefaultLevel};
         bool running_{false};
-        std::vector<std::shared_ptr<::FileDescriptor>> files_{};
-        uint64_t dpaging_begin_{0};
-        uint64_t dpaging_end_{0};
-        uint64_t file_map_end_{0};
-        std::vector<FileMapping> file_maps_{};
+        TaskState state_{TaskState::kAlive};
+        CPUMask affinity_{~CPUMask{0}};
+        std::shared_ptr<AddressSpace> space_;
+        std::vector<uint8_t> fpu_buf_{};
+        uint8_t* fpu_state_{nullptr};
+        /** @brief 公平スケジューラで使う．nice で重み付けした累積実行時間（ns）． */
+        uint64_t vruntime_{0};
+        /** @brief 最後に実行を始めた時刻（ns）． */
+        uint64_t exec_start_ns_{0};
+        int nice_{0};
+        /** @brief Wakeup された時刻（ns）．実行を始めたら 0 に戻す． */
+        uint64_t wakeup_ns_{0};
+        /** @brief 今のタイムスライスを始めた時刻（ns）． */
+        uint64_t slice_start_ns_{0};
+        uint64_t voluntary_switches_{0};
+        uint64_t involuntary_switches_{0};
+        /** @brief WaitFinish でこのタスクの終了を待っているタスクの数．終了時に終了コードと一緒に記録する． */
+        int finish_waited_{0};
 
         Task& SetLevel(int level) { level_ = level; return *this; }
         Task& SetRunning(bool running) { running_ = running; return *this; }
+        /** @brief 終了したタスクのアドレス空間と未読のメッセージを手放す．割り込みを許可して呼ぶ． */
+        void Release();
+        /** @brief 回収済みのオブジェクトを新しい ID のタスクとして初期化し直す．
+         * カーネルスタックと FPU の保存領域は確保したまま使い回す． */
+        void Reuse(uint64_t id);
 
         friend TaskManager;
 };
 
 
+/** @brief 起動時に選ぶスケジューリング方式． */
+enum class SchedulerClass {
+    /** @brief レベルごとのラウンドロビン．高いレベルのタスクを優先する． */
+    kPriority,
+    /** @brief 仮想実行時間が最小のタスクを選ぶ．レベルは無視し，nice で重みを付ける． */
+    kFair,
+};
+
 class TaskManager {
     public:
         // level : 0 = lowest, kMaxLevel = highest
         static const int kMaxLevel = 3;
+        static const int kMinNice = -20;
+        static const int kMaxNice = 19;
+        /** @brief 使い回すために取っておく Task オブジェクトの最大数． */
+        static const size_t kMaxFreeTasks = 32;
+        /** @brief WaitFinish されていない終了コードを覚えておく最大数．
+         * 超えたら終了した順に古いものから捨てる．ただし WaitFinish で待たれているものは捨てない． */
+        static const size_t kMaxExitStatuses = 256;
 
-        TaskManager();
-        Task& NewTask();
+        explicit TaskManager(SchedulerClass sched_class);
+        /** @brief タスクを作る．カーネルスタックを割り当てられなければエラー． */
+        WithError<Task*> NewTask();
         void SwitchTask(const TaskContext& current_ctx);
 
         void Sleep(Task* task);
         Error Sleep(uint64_t id);
         void Wakeup(Task* task, int level = -1);
+        void Wakeup(Task* const* tasks, size_t n);
         Error Wakeup(uint64_t id, int level = -1);
         Error SendMessage(uint64_t id, const Message& msg);
         Task& CurrentTask();
         void Finish(int exit_code);
         WithError<int> WaitFinish(uint64_t task_id);
+        /** @brief ID が id のタスクが task と同じアドレス空間を使っていれば true．割り込みを禁止した状態で呼ぶ． */
+        bool SharesSpace(uint64_t id, Task& task);
+        bool IsIdle() const;
+        /** @brief #NM から呼ばれ，FPU の状態を現在のタスクのものに切り替える． */
+        void SwitchFPU();
+        SchedulerClass Scheduler() const { return sched_class_; }
+        Error SetNice(Task* task, int nice);
+        /** @brief task を実行してよい CPU の集合を記録する．動作中の CPU を 1 つも含まなければエラー．
+         *
+         * CPU ごとの実行待ち行列はまだ無く（kNumCPUs = 1），スケジューラはこの集合を見ない．
+         * SMP に対応するまでは記録するだけで何もしない．
+         */
+        Error SetAffinity(Task* task, CPUMask mask);
+        /** @brief スケジューラの統計の写しを取る．割り込みを禁止した状態で呼ぶ． */
+        void GetSchedStats(std::array<SchedLevelStats, kMaxLevel + 1>& levels,
+                           std::vector<TaskSchedStat>& tasks) const;
+        void ResetSchedStats();
     private:
-        std::vector<std::unique_ptr<Task>> tasks_{};
+        /** @brief 公平スケジューラの実行待ちキューの順序．vruntime が同じなら ID 順． */
+        struct VRuntimeLess {
+            bool operator()(const Task* a, const Task* b) const {
+                if(a->VRuntime() != b->VRuntime()){
+                    return a->VRuntime() < b->VRuntime();
+                }
+                return a->ID() < b->ID();
+            }
+        };
+
+        SchedulerClass sched_class_;
+        /** @brief 終了していないタスク．ID で引く． */
+        std::map<uint64_t, std::unique_ptr<Task>> tasks_{};
+        /** @brief 終了したが資源をまだ回収していないタスク． */
+        std::vector<std::unique_ptr<Task>> zombies_{};
+        /** @brief 回収済みで NewTask が使い回せるタスク． */
+        std::vector<std::unique_ptr<Task>> free_tasks_{};
         uint64_t latest_id_{0};
         std::array<std::deque<Task*>, kMaxLevel + 1> running_{};
         int current_level_{kMaxLevel};
+        Task* idle_task_{nullptr};
+        /** @brief FPU レジスタに状態が載っているタスク．CR0.TS はこれ以外のタスクの実行中に立てる． */
+        Task* fpu_owner_{nullptr};
         bool level_changed_{false};
-        std::map<uint64_t, int> finish_tasks_{};
-        std::map<uint64_t, Task*> finish_waiter_{};
+        struct ExitStatus {
+            int exit_code;
+            /** @brief 終了したときに WaitFinish で待っていたタスクの数．0 でなければ捨てない． */
+            int waited;
+        };
+        /** @brief 終了したタスクの ID と終了コード． */
+        std::map<uint64_t, ExitStatus> finish_tasks_{};
+        /** @brief finish_tasks_ の ID を終了した順に並べたもの．先頭が最も古い． */
+        std::deque<uint64_t> finish_order_{};
+        /** @brief WaitFinish で他のタスクの終了を待っているタスク． */
+        WaitQueue finish_waiters_{};
+
+        /** @brief 公平スケジューラの実行待ちタスク（赤黒木）．実行中のタスクは含まない． */
+        std::set<Task*, VRuntimeLess> fair_queue_{};
+        Task* fair_current_{nullptr};
+        /** @brief 実行可能なタスクの vruntime の最小値．単調増加する． */
+        uint64_t min_vruntime_{0};
+        std::array<SchedLevelStats, kMaxLevel + 1> level_stats_{};
+
+        static CPUMask OnlineCPUs();
 
+        Task* FindTask(uint64_t id);
+        /** @brief zombies_ のタスクの資源を回収して free_tasks_ に移す． */
+        void ReapZombies();
+        /** @brief 終了コードが kMaxExitStatuses を超えた分を，待たれていない古いものから捨てる． */
+        void DropExitStatuses();
+        void MakeRunnable(Task* task, int level);
         void ChangeLevelRunning(Task* task, int level);
         Task* RotateCurrentRunQueue(bool current_sleep);
+        Task* RotateFairQueue(bool current_sleep);
+        void UpdateVRuntime(Task* task, uint64_t now_ns);
+        void UpdateMinVRuntime();
+        void AccountSwitch(Task* prev, Task* next, bool voluntary);
 };
 
 extern TaskManager* task_manager;
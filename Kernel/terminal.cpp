@@ -12,7 +12,12 @@
 #include "memory_manager.hpp"
 #include "paging.hpp"
 #include "timer.hpp"
+#include "interrupt.hpp"
+#include "idle.hpp"
 #include "keyboard.hpp"
+#include "sched_stat.hpp"
+#include "compositor.hpp"
+#include "graphics_bench.hpp"
 
 #include "logger.hpp"
 
@@ -135,15 +140,14 @@ namespace {
         const auto cr3 = reinterpret_cast<uint64_t>(pml4.value);
         SetCR3(cr3);
         current_task.Context().cr3 = cr3;
-        return pml4;
-    }
 
-    Error FreePML4(Task& current_task){
-        const auto cr3 = current_task.Context().cr3;
-        current_task.Context().cr3 = 0;
-        ResetCR3();
-
-  return FreePageMap(reinterpret_cast<PageMapEntry*>(cr3));
+        // 時計ページは全アプリで同じ物理ページを読み取り専用で共有する
+        const auto clock_page_phys = reinterpret_cast<uint64_t>(clock_page);
+        if(auto err = MapPhysicalPage(LinearAddress4Level{CLOCK_PAGE_ADDR},
+                                      clock_page_phys, false)){
+            return {pml4.value, err};
+        }
+        return pml4;
     }
 
     void ListAllEntries(FileDescriptor& fd, uint32_t dir_cluster){
@@ -403,7 +407,13 @@ void Terminal::ExecuteLine(){
             ++subcommand;   
         }
 
-        auto& subtask = task_manager->NewTask();
+        auto [subtask_ptr, err] = task_manager->NewTask();
+        if(err){
+            PrintToFD(*files_[2], "failed to create a subtask: %s\n", err.Name());
+            files_[1] = original_stdout;
+            return;
+        }
+        auto& subtask = *subtask_ptr;
         pipe_fd = std::make_shared<PipeDescriptor>(subtask);
         auto term_desc = new TerminalDescriptor{
             subcommand, true, false,
@@ -411,10 +421,11 @@ void Terminal::ExecuteLine(){
         };
         files_[1] = pipe_fd;
 
-        subtask_id = subtask
+        // Wakeup の後は subtask が終了して使い回されることがあるので，ID は先に読む
+        subtask_id = subtask.ID();
+        subtask
             .InitContext(TaskTerminal, reinterpret_cast<int64_t>(term_desc))
-            .Wakeup()
-            .ID();
+            .Wakeup();
         (*layer_task_map)[layer_id_] = subtask_id;
     }
 
@@ -498,9 +509,13 @@ void Terminal::ExecuteLine(){
         auto term_desc = new TerminalDescriptor {
             first_arg, true, false, files_
         };
-        task_manager->NewTask()
-            .InitContext(TaskTerminal, reinterpret_cast<int64_t>(term_desc))
-            .Wakeup();
+        if(auto [task, err] = task_manager->NewTask(); err){
+            PrintToFD(*files_[2], "failed to create a task: %s\n", err.Name());
+            delete term_desc;
+        } else {
+            task->InitContext(TaskTerminal, reinterpret_cast<int64_t>(term_desc))
+                .Wakeup();
+        }
     } else if(strcmp(command, "memstat") == 0){
         const auto p_stat = memory_manager->Stat();
 
@@ -510,6 +525,56 @@ void Terminal::ExecuteLine(){
         PrintToFD(*files_[1], "Phys total: %lu frames (%llu MiB)\n",
                 p_stat.total_frames,
                 p_stat.total_frames * kBytesPerFrame / 1024 / 1024);
+    } else if(strcmp(command, "cpustat") == 0){
+        for(int cpu = 0; cpu < kNumCPUs; ++cpu){
+            const auto busy = BusyPermille(cpu);
+            const auto idle_ms = IdleCycles(cpu) * 1000 / tsc_freq;
+            PrintToFD(*files_[1], "CPU%d: %u.%u%% busy, idle %lu ms total\n",
+                    cpu, busy / 10, busy % 10, idle_ms);
+        }
+    } else if(strcmp(command, "gfxbench") == 0){
+        if(first_arg && strcmp(first_arg, "ops") == 0){
+            RunPixelOpsBenchmark(*files_[1]);
+        } else {
+            RunGraphicsBenchmark(*files_[1]);
+        }
+    } else if(strcmp(command, "schedstat") == 0){
+        if(first_arg && strcmp(first_arg, "reset") == 0){
+            const auto rflags = SaveAndDisableInterrupts();
+            task_manager->ResetSchedStats();
+            RestoreInterrupts(rflags);
+        } else if(first_arg && strcmp(first_arg, "log") == 0){
+            PrintSchedStats(nullptr);
+        } else {
+            PrintSchedStats(files_[1].get());
+        }
+    } else if(strcmp(command, "irqoff") == 0){
+        if(first_arg && strcmp(first_arg, "reset") == 0){
+            const auto rflags = SaveAndDisableInterrupts();
+            irq_off_stat.max_cycles = 0;
+            irq_off_stat.sections = 0;
+            RestoreInterrupts(rflags);
+        } else {
+            const auto max_cycles = irq_off_stat.max_cycles;
+            PrintToFD(*files_[1], "irq off: max %lu cycles (%lu us) in %lu sections\n",
+                    max_cycles, max_cycles * 1'000'000 / tsc_freq, irq_off_stat.sections);
+        }
+    } else if(strcmp(command, "compstat") == 0){
+        if(first_arg && strcmp(first_arg, "reset") == 0){
+            const auto rflags = SaveAndDisableInterrupts();
+            compositor->ResetStats();
+            RestoreInterrupts(rflags);
+        } else {
+            PrintCompositorStats(*files_[1]);
+        }
+    } else if(strcmp(command, "fontstat") == 0){
+        if(first_arg && strcmp(first_arg, "reset") == 0){
+            ResetGlyphCacheStats();
+        } else {
+            const auto stats = GetGlyphCacheStats();
+            PrintToFD(*files_[1], "glyph cache: %lu hits, %lu misses, %lu evictions, %lu cached\n",
+                    stats.hits, stats.misses, stats.evictions, stats.cached);
+        }
     } else if(command[0] != 0){
         auto file_entry = FindCommand(command);
         if(!file_entry){
@@ -528,10 +593,10 @@ void Terminal::ExecuteLine(){
 
     if(pipe_fd){
         pipe_fd->FinishWrite();
-        __asm__("cli");
+        DisableInterrupts();
         auto [ec, err] = task_manager->WaitFinish(subtask_id);
         (*layer_task_map)[layer_id_] = task_.ID();
-        __asm__("sti");
+        EnableInterrupts();
         if(err){
             Log(kWarn, "failed to wait finish: %s\n", err.Name());
         }
@@ -544,14 +609,15 @@ void Terminal::ExecuteLine(){
 
 WithError<int> Terminal::ExecuteFile(fat::DirectoryEntry& file_entry,
                                      char* command, char* first_arg){
-    __asm__("cli");
+    DisableInterrupts();
     auto& task = task_manager->CurrentTask();
-    __asm__("sti");
+    EnableInterrupts();
 
     auto [ app_load, err ] = LoadApp(file_entry, task);
     if (err){
         return {0, err};
     }
+    task.Space().pml4 = app_load.pml4;
 
     LinearAddress4Level args_frame_addr{0xffff'ffff'ffff'f000};
     if(auto err = SetupPageMaps(args_frame_addr, 1)){
@@ -582,19 +648,28 @@ WithError<int> Terminal::ExecuteFile(fat::DirectoryEntry& file_entry,
     task.SetDPagingBegin(elf_next_page);
     task.SetDPagingEnd(elf_next_page);
 
-    task.SetFileMapEnd(stack_frame_addr.value);
+    static_assert(0xffff'ffff'ffff'f000 - stack_size - 4096 == CLOCK_PAGE_ADDR);
+    task.SetFileMapEnd(CLOCK_PAGE_ADDR);
     
+    const int nice = task.Nice();
+    const CPUMask affinity = task.Affinity();
     int ret = CallApp(argc.value, argv, 3 << 3 | 3, app_load.entry,
         stack_frame_addr.value + stack_size - 8,
         &task.OSStackPointer());
-
-    task.Files().clear();
-    task.FileMaps().clear();
-
-    if(auto err = CleanPageMaps(LinearAddress4Level{0xffff'8000'0000'0000})){
-        return {ret, err};
-    }
-    return {ret, FreePML4(task)};
+    const auto rflags = SaveAndDisableInterrupts();
+    task_manager->SetNice(&task, nice);
+    task_manager->SetAffinity(&task, affinity);
+
+    task.Context().cr3 = 0;
+    ResetCR3();
+
+    // アプリのスレッドがまだ動いていれば，ページテーブルなどは
+    // 最後のスレッドが終わったときに解放される
+    auto old_space = task.ResetSpace();
+    RestoreInterrupts(rflags);
+    // 解放は割り込みを許可してから行う
+    old_space.reset();
+    return {ret, MAKE_ERROR(Error::kSuccess)};
 }
 
 void Terminal::Print(char32_t c){
@@ -652,9 +727,9 @@ void Terminal::Print(const char* s, std::optional<size_t> len){
 
     Message msg = MakeLayerMessage(
         task_.ID(), LayerID(), LayerOperation::DrawArea, draw_area);
-    __asm__("cli");
+    DisableInterrupts();
     task_manager->SendMessage(1, msg);
-    __asm__("sti");
+    EnableInterrupts();
 }
 
 Rectangle<int> Terminal::HistoryUpDown(int direction){
@@ -689,9 +764,9 @@ void Terminal::Redraw(){
     
     Message msg = MakeLayerMessage(
         task_.ID(), LayerID(), LayerOperation::DrawArea, draw_area);
-    __asm__("cli");
+    DisableInterrupts();
     task_manager->SendMessage(1, msg);
-    __asm__("sti");
+    EnableInterrupts();
 }
 
 void TaskTerminal(uint64_t task_id, int64_t data) {
@@ -701,15 +776,22 @@ void TaskTerminal(uint64_t task_id, int64_t data) {
         show_window = term_desc->show_window;
     }
 
-    __asm__("cli");
+    DisableInterrupts();
     Task& task = task_manager->CurrentTask();
-    Terminal* terminal = new Terminal{task, term_desc};
-    if(show_window){
-        layer_manager->Move(terminal->LayerID(), {100, 200});
-        layer_task_map->insert(std::make_pair(terminal->LayerID(), task_id));
-        active_layer->Activate(terminal->LayerID());
+    EnableInterrupts();
+
+    Terminal* terminal;
+    {
+        LockGuard lock{layer_manager->GetLock()};
+        terminal = new Terminal{task, term_desc};
+        if(show_window){
+            layer_manager->Move(terminal->LayerID(), {100, 200});
+            const auto rflags = SaveAndDisableInterrupts();
+            layer_task_map->insert(std::make_pair(terminal->LayerID(), task_id));
+            RestoreInterrupts(rflags);
+            active_layer->Activate(terminal->LayerID());
+        }
     }
-    __asm__("sti");
 
     if(term_desc && !term_desc->command_line.empty()){
         for(int i = 0; i < term_desc->command_line.length(); ++i){
@@ -720,28 +802,30 @@ void TaskTerminal(uint64_t task_id, int64_t data) {
 
     if(term_desc && term_desc->exit_after_command){
         delete term_desc;
-        __asm__("cli");
+        DisableInterrupts();
         task_manager->Finish(terminal->LastExitCode());
-        __asm__("sti");
+        EnableInterrupts();
     }
 
     auto add_blink_timer = [task_id](unsigned long t){
+        const auto rflags = SaveAndDisableInterrupts();
         timer_manager->AddTimer(Timer{t + static_cast<int>(kTimerFreq  * 0.5),
                                         1, task_id});
+        RestoreInterrupts(rflags);
     };
     add_blink_timer(timer_manager->CurrentTick());
     
     bool window_isactive = false;
 
     while(true){
-        __asm__("cli");
+        DisableInterrupts();
         auto msg = task.ReceiveMessage();
         if(!msg){
             task.Sleep();
-            __asm__("sti");
+            EnableInterrupts();
             continue;
         }
-        __asm__("sti");
+        EnableInterrupts();
 
         switch(msg->type){
             case Message::kTimerTimeout:
@@ -750,9 +834,9 @@ void TaskTerminal(uint64_t task_id, int64_t data) {
                         const auto area = terminal->BlinkCursor();
                         Message msg = MakeLayerMessage(
                             task_id, terminal->LayerID(), LayerOperation::DrawArea, area);
-                        __asm__("cli");
+                        DisableInterrupts();
                         task_manager->SendMessage(1, msg);
-                        __asm__("sti");
+                        EnableInterrupts();
                     }
                 break;
             case Message::kKeyPush:
@@ -763,9 +847,9 @@ void TaskTerminal(uint64_t task_id, int64_t data) {
                         if (show_window) {
                             Message msg = MakeLayerMessage(
                                 task_id, terminal->LayerID(), LayerOperation::DrawArea, area);
-                            __asm__("cli");
+                            DisableInterrupts();
                             task_manager->SendMessage(1, msg);
-                            __asm__("sti");
+                            EnableInterrupts();
                         }
                     }
                 break;
@@ -774,7 +858,7 @@ void TaskTerminal(uint64_t task_id, int64_t data) {
                 break;
             case Message::kWindowClose:
                 CloseLayer(msg->arg.window_close.layer_id);
-                __asm__("cli");
+                DisableInterrupts();
                 task_manager->Finish(terminal->LastExitCode());
                 break;
             default:
@@ -792,13 +876,13 @@ size_t TerminalFileDescriptor::Read(void* buf, size_t len){
     char* bufc = reinterpret_cast<char*>(buf);
 
     while(true){
-        __asm__("cli");
+        DisableInterrupts();
         auto msg = term_.UnderlyingTask().ReceiveMessage();
         if(!msg){
             term_.UnderlyingTask().Sleep();
             continue;
         }
-        __asm__("sti");
+        EnableInterrupts();
 
         if(msg->type != Message::kKeyPush || !msg->arg.keyboard.press){
             continue;
@@ -831,7 +915,7 @@ size_t TerminalFileDescriptor::Load(void* buf, size_t len, size_t offset){
     return 0;
 }
 
-PipeDescriptor::PipeDescriptor(Task& task) : task_{task}{
+PipeDescriptor::PipeDescriptor(Task& task) : task_{task}, task_id_{task.ID()}{
 
 }
 
@@ -851,27 +935,23 @@ size_t PipeDescriptor::Read(void* buf, size_t len){
     }
 
     while(true){
-        __asm__("cli");
-        auto msg = task_.ReceiveMessage();
-        if(!msg){
-            task_.Sleep();
-            continue;
-        }
-        __asm__("sti");
+        DisableInterrupts();
+        auto msg = task_.WaitMessage();
+        EnableInterrupts();
 
-        if(msg->type != Message::kPipe){
+        if(msg.type != Message::kPipe){
             continue;
         }
 
-        if(msg->arg.pipe.len == 0){
+        if(msg.arg.pipe.len == 0){
             closed_ = true;
             return 0;
         }
 
-        const size_t copy_bytes = std::min<size_t>(msg->arg.pipe.len, len);
-        memcpy(buf, msg->arg.pipe.data, copy_bytes);
-        len_ = msg->arg.pipe.len - copy_bytes;
-        memcpy(data_, &msg->arg.pipe.data[copy_bytes], len_);
+        const size_t copy_bytes = std::min<size_t>(msg.arg.pipe.len, len);
+        memcpy(buf, msg.arg.pipe.data, copy_bytes);
+        len_ = msg.arg.pipe.len - copy_bytes;
+        memcpy(data_, &msg.arg.pipe.data[copy_bytes], len_);
         return copy_bytes;
     }
 }
@@ -884,18 +964,16 @@ size_t PipeDescriptor::Write(const void* buf, size_t len){
         msg.arg.pipe.len = std::min(len - sent_bytes, sizeof(msg.arg.pipe.data));
         memcpy(msg.arg.pipe.data, &bufc[sent_bytes], msg.arg.pipe.len);
         sent_bytes += msg.arg.pipe.len;
-        __asm__("cli");
-        task_.SendMessage(msg);
-        __asm__("sti");
+        DisableInterrupts();
+        task_manager->SendMessage(task_id_, msg);
+        EnableInterrupts();
     }
     return len;
 }
 void PipeDescriptor::FinishWrite() {
     Message msg{Message::kPipe};
     msg.arg.pipe.len = 0;
-    __asm__("cli");
-    task_.SendMessage(msg);
-    __asm__("sti");
-
-
+    DisableInterrupts();
+    task_manager->SendMessage(task_id_, msg);
+    EnableInterrupts();
 }
\ No newline at end of file
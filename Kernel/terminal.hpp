@@ -88,6 +88,8 @@ class PipeDescriptor : public FileDescriptor {
         void FinishWrite();
     private:
         Task& task_;
+        /** @brief 書き込み側は ID でメッセージを送る．読み出し側が先に終了していてもよい． */
+        uint64_t task_id_;
         char data_[16];
         size_t len_{0};
         bool closed_{false};
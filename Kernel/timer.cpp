@@ -1,7 +1,10 @@
 #include "timer.hpp"
 
+#include <algorithm>
 #include "acpi.hpp"
+#include "asmfunc.h"
 #include "interrupt.hpp"
+#include "msr.hpp"
 #include "task.hpp"
 
 namespace {
@@ -10,6 +13,111 @@ namespace {
     volatile uint32_t& initial_count = *reinterpret_cast<uint32_t*>(0xfee00380);
     volatile uint32_t& current_count = *reinterpret_cast<uint32_t*>(0xfee00390);
     volatile uint32_t& divide_config = *reinterpret_cast<uint32_t*>(0xfee003e0);   
+
+    bool tsc_deadline_supported = false;
+
+    /** @brief 時計ページと同じページに他の変数が載らないよう 1 ページ分確保する． */
+    union alignas(4096) ClockPageFrame {
+        ClockPage page;
+        uint8_t bytes[4096];
+    } clock_page_frame{};
+
+    /** @brief 時計ページを書き換える．アプリは sequence を見て書き換え中の値を読み捨てる． */
+    template <class F>
+    void UpdateClockPage(F update) {
+        ++clock_page->sequence;
+        __asm__ volatile("" ::: "memory");
+        update(*clock_page);
+        __asm__ volatile("" ::: "memory");
+        ++clock_page->sequence;
+    }
+
+    /** @brief 単調増加する時計の読み出し元．
+     *
+     * CPU が invariant TSC を持っていれば TSC を，そうでなければ 64 ビットに
+     * 拡張した ACPI PM タイマを使う．PM タイマは 24 ビットだと約 4.7 秒で一周するので，
+     * それより短い間隔で読まれる必要がある．tickless 時に眠る時間を kMaxSleepTicks に
+     * 制限しているのはこのため．
+     */
+    bool clock_use_tsc = false;
+    uint64_t clock_tsc_base = 0;
+    uint64_t pm_timer_last = 0;
+    uint64_t pm_timer_total = 0;
+    /** @brief 時計のカウントをナノ秒に変換する係数．ns = (count * clock_ns_mult) >> 32 */
+    uint64_t clock_ns_mult = 0;
+
+    const uint64_t kNanosecondsPerSecond = 1'000'000'000;
+    const uint64_t kNanosecondsPerTick = kNanosecondsPerSecond / kTimerFreq;
+
+    uint64_t ReadClockCount() {
+        if (clock_use_tsc) {
+            return ReadTSC() - clock_tsc_base;
+        }
+
+        const auto rflags = SaveAndDisableInterrupts();
+        const bool pm_timer_32 = (acpi::fadt->flags >> 8) & 1;
+        const uint64_t mask = pm_timer_32 ? 0xffffffffu : 0x00ffffffu;
+        const uint64_t raw = IoIn32(acpi::fadt->pm_tmr_blk) & mask;
+        pm_timer_total += (raw - pm_timer_last) & mask;
+        pm_timer_last = raw;
+        const uint64_t total = pm_timer_total;
+        RestoreInterrupts(rflags);
+        return total;
+    }
+
+    uint64_t ClockCountToNs(uint64_t count) {
+        return static_cast<uint64_t>(
+            (static_cast<unsigned __int128>(count) * clock_ns_mult) >> 32);
+    }
+
+    bool HasInvariantTSC() {
+        uint32_t eax, ebx, ecx, edx;
+        CPUID(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+        if (eax < 0x80000007) {
+            return false;
+        }
+        CPUID(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+        return (edx >> 8) & 1;
+    }
+
+    /** @brief 時計を 0 ナノ秒から始める． */
+    void InitializeClock() {
+        clock_use_tsc = HasInvariantTSC() && tsc_freq > 0;
+        const uint64_t clock_freq = clock_use_tsc ? tsc_freq : acpi::kPMTimerFreq;
+        clock_ns_mult = (kNanosecondsPerSecond << 32) / clock_freq;
+
+        clock_tsc_base = ReadTSC();
+        pm_timer_last = 0;
+        ReadClockCount();
+        pm_timer_total = 0;
+
+        UpdateClockPage([](ClockPage& page) {
+            page.timer_freq = kTimerFreq;
+            page.tick = 0;
+            page.tsc_base = clock_tsc_base;
+            page.tsc_ns_mult = clock_use_tsc ? clock_ns_mult : 0;
+        });
+    }
+
+    unsigned long TimeNsToTick(uint64_t ns) {
+        return ns / kNanosecondsPerTick;
+    }
+
+    /** @brief delay_ns ナノ秒後に LAPIC タイマ割り込みが来るようにする．
+     *
+     * delay_ns は kMaxSleepTicks 以下に抑えられているので，掛け算は溢れない．
+     */
+    void ArmLAPICTimer(uint64_t delay_ns) {
+        if (tsc_deadline_supported) {
+            const uint64_t tsc_delay = delay_ns * tsc_freq / kNanosecondsPerSecond;
+            WriteMSR(kIA32_TSC_DEADLINE, ReadTSC() + std::max<uint64_t>(tsc_delay, 1));
+            return;
+        }
+
+        uint64_t count = delay_ns * lapic_timer_freq / kNanosecondsPerSecond;
+        count = std::min<uint64_t>(std::max<uint64_t>(count, 1), kCountMax);
+        initial_count = count;
+    }
 }
 
 void InitializeLAPICTimer(){
@@ -18,16 +126,35 @@ void InitializeLAPICTimer(){
   divide_config = 0b1011; // divide 1:1
   lvt_timer = 0b001 << 16; // masked, one-shot
 
+    const auto tsc_start = ReadTSC();
     StartLAPICTimer();
     acpi::WaitMilliseconds(100);
     const auto elapsed = LAPICTimerElapsed();
     StopLAPICTimer();
+    const auto tsc_elapsed = ReadTSC() - tsc_start;
 
   lapic_timer_freq = static_cast<unsigned long>(elapsed) * 10;
+    tsc_freq = tsc_elapsed * 10;
+
+    uint32_t eax, ebx, ecx, edx;
+    CPUID(1, 0, &eax, &ebx, &ecx, &edx);
+    tsc_deadline_supported = (ecx >> 24) & 1;
+
+    InitializeClock();
 
   divide_config = 0b1011; // divide 1:1
-  lvt_timer = (0b010 << 16) | InterruptVector::kLAPICTimer; // not-masked, periodic
-  initial_count = lapic_timer_freq / kTimerFreq;
+    if (!kTicklessIdle) {
+    lvt_timer = (0b010 << 16) | InterruptVector::kLAPICTimer; // not-masked, periodic
+        initial_count = lapic_timer_freq / kTimerFreq;
+        return;
+    }
+
+    if (tsc_deadline_supported) {
+    lvt_timer = (0b100 << 16) | InterruptVector::kLAPICTimer; // not-masked, TSC-deadline
+    } else {
+    lvt_timer = (0b000 << 16) | InterruptVector::kLAPICTimer; // not-masked, one-shot
+    }
+    timer_manager->ProgramNextEvent();
 }
 
 void StartLAPICTimer() {
@@ -48,46 +175,250 @@ Timer::Timer(unsigned long timeout, int value, uint64_t task_id)
 }
 
 TimerManager::TimerManager(){
-    timers_.push(Timer{std::numeric_limits<unsigned long>::max(), 0, 0});
+    for(size_t i = 0; i < nodes_.size(); ++i){
+        nodes_[i].level = -1;
+        nodes_[i].next = i + 1 < nodes_.size() ? &nodes_[i + 1] : nullptr;
+    }
+    free_list_ = &nodes_[0];
+}
+
+TimerID TimerManager::AddTimer(const Timer& timer){
+    TimerNode* node = AllocateNode();
+    if(node == nullptr){
+        return kInvalidTimerID;
+    }
+
+    node->timer = timer;
+    Insert(node, tick_ + 1);
+    if(kTicklessIdle && timer.Timeout() < next_event_tick_){
+        ProgramNextEvent();
+    }
+    return MakeID(node);
 }
 
-void TimerManager::AddTimer(const Timer& timer){
-    timers_.push(timer);
+bool TimerManager::CancelTimer(TimerID id){
+    const size_t index = (id & 0xffffffffu) - 1;
+    const uint32_t generation = id >> 32;
+    if(id == kInvalidTimerID || index >= nodes_.size()){
+        return false;
+    }
+
+    TimerNode* node = &nodes_[index];
+    if(node->level < 0 || node->generation != generation){
+        // 既に期限切れになったか，取り消し済み
+        return false;
+    }
+
+    Unlink(node);
+    FreeNode(node);
+    return true;
+}
+
+unsigned long TimerManager::CurrentTick() const {
+    return TimeNsToTick(CurrentTimeNs());
 }
 
+uint64_t TimerManager::CurrentTimeNs() const {
+    return ClockCountToNs(ReadClockCount());
+}
+
+/** @brief 前回の呼び出しから時計が進んだ分だけタイマを処理する． */
 bool TimerManager::Tick(){
+    const auto now = CurrentTick();
+    bool task_timer_timeout = false;
+    while(tick_ < now){
+        if(Advance()){
+            task_timer_timeout = true;
+        }
+    }
+    UpdateClockPage([this](ClockPage& page) { page.tick = tick_; });
+    return task_timer_timeout;
+}
+
+/**
+ * @brief 次に LAPIC タイマ割り込みを起こす時刻を決めてプログラムする．
+ *
+ * 実行可能なタスクがアイドルタスクだけのときは，タスク切り替え用タイマを無視して
+ * 次のタイマの期限まで眠る．
+ */
+void TimerManager::ProgramNextEvent(){
+    if(!kTicklessIdle){
+        return;
+    }
+
+    const bool idle = task_manager && task_manager->IsIdle();
+    const auto now_ns = CurrentTimeNs();
+    const unsigned long processed = tick_;
+    const auto now_tick = std::max(processed, TimeNsToTick(now_ns));
+
+    next_event_tick_ = std::min(NextExpiry(idle), now_tick + kMaxSleepTicks);
+    const uint64_t deadline_ns = next_event_tick_ * kNanosecondsPerTick;
+    ArmLAPICTimer(deadline_ns > now_ns ? deadline_ns - now_ns : 0);
+}
+
+bool TimerManager::Advance(){
     ++tick_;
-    
+
+    const int index = tick_ & (kWheelSlots - 1);
+    if(index == 0){
+        Cascade(1);
+    }
+
     bool task_timer_timeout = false;
-    while(true){
-        const auto& t = timers_.top();
+
+    // 処理中に同じスロットへ再登録されるタイマがあるので，先にリストを切り離す。
+    TimerNode* node = wheel_[0][index];
+    wheel_[0][index] = nullptr;
+    while(node){
+        TimerNode* next = node->next;
+        const Timer& t = node->timer;
+
         if(t.Timeout() > tick_){
-            break;
+            // ホイールの範囲を超える遠い期限のタイマ。もう一周待つ。
+            Insert(node, tick_ + 1);
+        } else if(t.Value() == kTaskTimerValue){
+            task_timer_timeout = true;
+            node->timer = Timer{tick_ + kTaskTimerPeriod, kTaskTimerValue, 1};
+            Insert(node, tick_ + 1);
+        } else {
+            Message m{Message::kTimerTimeout};
+            m.arg.timer.timeout = t.Timeout();
+            m.arg.timer.value = t.Value();
+            task_manager->SendMessage(t.TaskID(), m);
+            FreeNode(node);
         }
+        node = next;
+    }
+    return task_timer_timeout;
+}
 
-        if(t.Value() == kTaskTimerValue){
-            task_timer_timeout = true;
-            timers_.pop();
-            timers_.push(Timer{tick_ + kTaskTimerPeriod, kTaskTimerValue, 1});
-            continue;
+TimerManager::TimerNode* TimerManager::AllocateNode(){
+    TimerNode* node = free_list_;
+    if(node == nullptr){
+        return nullptr;
+    }
+    free_list_ = node->next;
+    ++node->generation;
+    if(node->generation == 0){
+        node->generation = 1;
+    }
+    return node;
+}
+
+void TimerManager::FreeNode(TimerNode* node){
+    node->level = -1;
+    node->prev = nullptr;
+    node->next = free_list_;
+    free_list_ = node;
+}
+
+/**
+ * @brief タイマを期限に応じた段とスロットに登録する．
+ *
+ * @param base  次に処理される tick．期限が base より前のタイマは base で期限切れにする．
+ */
+void TimerManager::Insert(TimerNode* node, unsigned long base){
+    unsigned long timeout = std::max(node->timer.Timeout(), base);
+    unsigned long delta = timeout - base;
+
+    int level = 0;
+    while(level < kWheelLevels - 1 &&
+          delta >= (1ul << (kWheelBits * (level + 1)))){
+        ++level;
+    }
+
+    const unsigned long max_delta = (1ul << (kWheelBits * kWheelLevels)) - 1;
+    if(delta > max_delta){
+        // 最上段でも表せない期限は，最上段の一番遠いスロットに置いておき，
+        // cascade されたときに改めて振り分ける。
+        timeout = base + max_delta;
+    }
+
+    const int slot = (timeout >> (kWheelBits * level)) & (kWheelSlots - 1);
+    node->level = level;
+    node->slot = slot;
+    node->prev = nullptr;
+    node->next = wheel_[level][slot];
+    if(node->next){
+        node->next->prev = node;
+    }
+    wheel_[level][slot] = node;
+}
+
+void TimerManager::Unlink(TimerNode* node){
+    if(node->prev){
+        node->prev->next = node->next;
+    } else {
+        wheel_[node->level][node->slot] = node->next;
+    }
+    if(node->next){
+        node->next->prev = node->prev;
+    }
+}
+
+/** @brief level 段目の現在のスロットのタイマを下位の段に振り分け直す． */
+void TimerManager::Cascade(int level){
+    if(level >= kWheelLevels){
+        return;
+    }
+
+    const int index = (tick_ >> (kWheelBits * level)) & (kWheelSlots - 1);
+    if(index == 0){
+        Cascade(level + 1);
+    }
+
+    TimerNode* node = wheel_[level][index];
+    wheel_[level][index] = nullptr;
+    while(node){
+        TimerNode* next = node->next;
+        Insert(node, tick_);
+        node = next;
+    }
+}
+
+/**
+ * @brief 次にタイマを処理する必要がある tick を返す．
+ *
+ * 上位の段にあるタイマについては cascade が必要になる tick を返すので，
+ * 実際の期限より早いことがある．
+ */
+unsigned long TimerManager::NextExpiry(bool ignore_task_timer) const {
+    auto has_timer = [ignore_task_timer](const TimerNode* node){
+        for(; node; node = node->next){
+            if(!ignore_task_timer || node->timer.Value() != kTaskTimerValue){
+                return true;
+            }
         }
-        Message m{Message::kTimerTimeout};
-        m.arg.timer.timeout = t.Timeout();
-        m.arg.timer.value = t.Value();
-        task_manager->SendMessage(t.TaskID(), m);
-        // msg_queue_.push_back(m);
+        return false;
+    };
 
-        // タイム・アウトしたタイマは取り出されている。
-        timers_.pop();
+    unsigned long next = std::numeric_limits<unsigned long>::max();
+    for(int level = 0; level < kWheelLevels; ++level){
+        const int shift = kWheelBits * level;
+        const unsigned long base = tick_ >> shift;
+        for(int i = 1; i <= kWheelSlots; ++i){
+            if(has_timer(wheel_[level][(base + i) & (kWheelSlots - 1)])){
+                next = std::min(next, (base + i) << shift);
+                break;
+            }
+        }
     }
-    return task_timer_timeout;
+    return next;
+}
+
+TimerID TimerManager::MakeID(const TimerNode* node) const {
+    const uint64_t index = node - &nodes_[0];
+    return static_cast<uint64_t>(node->generation) << 32 | (index + 1);
 }
 
 TimerManager* timer_manager;
 unsigned long lapic_timer_freq;
+unsigned long tsc_freq;
+ClockPage* const clock_page = &clock_page_frame.page;
 
 extern "C" void LAPICTimerOnInterrupt(const TaskContext& ctx_stack){
     const bool task_timer_timeout = timer_manager->Tick();
+    timer_manager->ProgramNextEvent();
     NotifyEndOfInterrupt();
 
     if(task_timer_timeout){
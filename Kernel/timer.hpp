@@ -1,9 +1,10 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <queue>
-#include <vector>
 #include <limits>
+#include "clock_page.hpp"
 #include "message.hpp"
 
 void InitializeLAPICTimer();
@@ -13,35 +14,83 @@ void StopLAPICTimer();
 
 class Timer{
     public:
+        Timer() = default;
         Timer(unsigned long timeout, int value, uint64_t task_id);
         unsigned long Timeout() const { return timeout_; }
         int Value() const { return value_; }
         uint64_t TaskID() const { return task_id_; }
     private:
-        unsigned long timeout_;
-        int value_;
-        uint64_t task_id_;
+        unsigned long timeout_{0};
+        int value_{0};
+        uint64_t task_id_{0};
 };
 
-/** @brief ^C}[DxrB^CAEgقǗDxB */
-inline bool operator<(const Timer& lhs, const Timer& rhs){
-    return lhs.Timeout() > rhs.Timeout();
-}
+/** @brief AddTimer が返すタイマの識別子。CancelTimer に渡して取り消す。 */
+using TimerID = uint64_t;
+const TimerID kInvalidTimerID = 0;
 
+/** @brief 階層型タイミングホイールでタイマを管理するクラス．
+ *
+ * 1 段あたり kWheelSlots 個のスロットを kWheelLevels 段持つ．
+ * 0 段目のスロットは 1 tick 単位，n 段目のスロットは kWheelSlots^n tick 単位で，
+ * 上位の段のタイマは期限が近づいたときに下位の段へ移し替える（cascade）．
+ * タイマの実体は固定長のプール nodes_ から取るので，追加・期限切れとも O(1) で
+ * 割り込みコンテキストでのメモリ確保は発生しない．
+ */
 class TimerManager{
     public:
+        static const int kWheelBits = 6;
+        static const int kWheelSlots = 1 << kWheelBits;
+        static const int kWheelLevels = 4;
+        static const size_t kMaxTimers = 1024;
+
         TimerManager();
-        void AddTimer(const Timer& timer);
+        TimerID AddTimer(const Timer& timer);
+        bool CancelTimer(TimerID id);
         bool Tick();
-        unsigned long CurrentTick() const { return tick_; }
+        unsigned long CurrentTick() const;
+        uint64_t CurrentTimeNs() const;
+        void ProgramNextEvent();
     private:
+        struct TimerNode {
+            Timer timer;
+            TimerNode* prev;
+            TimerNode* next;
+            uint32_t generation;
+            int8_t level;   // -1 : 未使用（フリーリスト上）
+            uint8_t slot;
+        };
+
+        /** @brief 処理済みの tick．CurrentTick() より遅れていることがある． */
         volatile unsigned long tick_{0};
-        std::priority_queue<Timer> timers_{};
+        /** @brief LAPIC タイマを次に発火させるようにプログラムした tick． */
+        unsigned long next_event_tick_{0};
+        std::array<TimerNode, kMaxTimers> nodes_{};
+        TimerNode* free_list_{nullptr};
+        std::array<std::array<TimerNode*, kWheelSlots>, kWheelLevels> wheel_{};
+
+        TimerNode* AllocateNode();
+        void FreeNode(TimerNode* node);
+        void Insert(TimerNode* node, unsigned long base);
+        void Unlink(TimerNode* node);
+        void Cascade(int level);
+        bool Advance();
+        unsigned long NextExpiry(bool ignore_task_timer) const;
+        TimerID MakeID(const TimerNode* node) const;
 };
 
 extern TimerManager* timer_manager;
 extern unsigned long lapic_timer_freq;
-const int kTimerFreq = 100;
+extern unsigned long tsc_freq;
+/** @brief アプリにマップする時計ページ．4KiB 境界に置かれ，1 ページを占有する． */
+extern ClockPage* const clock_page;
+const int kTimerFreq = 1000;
+
+/** @brief true なら LAPIC タイマを周期モードで使わず，次のタイマの期限に合わせて
+ * ワンショットでプログラムする．アイドル中はタスク切り替え用タイマも無視する． */
+const bool kTicklessIdle = true;
+/** @brief tickless 時に 1 回の LAPIC タイマで眠る最大の tick 数． */
+const unsigned long kMaxSleepTicks = kTimerFreq;
 
 const int kTaskTimerPeriod = static_cast<int>(kTimerFreq * 0.02);
 const int kTaskTimerValue = std::numeric_limits<int>::max();
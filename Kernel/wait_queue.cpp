@@ -0,0 +1,144 @@
+#include "wait_queue.hpp"
+
+#include <array>
+#include "interrupt.hpp"
+#include "task.hpp"
+
+bool WaitQueue::Wait(uint64_t key) {
+    Task& task = task_manager->CurrentTask();
+    Entry entry{&task, key, tail_, nullptr};
+    if (tail_) {
+        tail_->next = &entry;
+    } else {
+        head_ = &entry;
+    }
+    tail_ = &entry;
+
+    task.Sleep();
+
+    // Wakeup 以外の理由で起こされたときはまだ行列に残っている
+    if (entry.task) {
+        Unlink(&entry);
+        return false;
+    }
+    return true;
+}
+
+size_t WaitQueue::Wakeup(size_t n) {
+    return WakeupIf(n, [](const Entry&) { return true; });
+}
+
+size_t WaitQueue::WakeupKey(uint64_t key, size_t n) {
+    return WakeupIf(n, [key](const Entry& e) { return e.key == key; });
+}
+
+template <class Pred>
+size_t WaitQueue::WakeupIf(size_t n, Pred pred) {
+    std::array<Task*, 16> batch;
+    size_t woken = 0;
+    Entry* entry = head_;
+    while (woken < n && entry) {
+        size_t batch_len = 0;
+        while (batch_len < batch.size() && woken < n && entry) {
+            Entry* next = entry->next;
+            if (pred(*entry)) {
+                Unlink(entry);
+                batch[batch_len++] = entry->task;
+                entry->task = nullptr;
+                ++woken;
+            }
+            entry = next;
+        }
+        task_manager->Wakeup(batch.data(), batch_len);
+    }
+    return woken;
+}
+
+void WaitQueue::Unlink(Entry* entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        head_ = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        tail_ = entry->prev;
+    }
+    entry->prev = entry->next = nullptr;
+}
+
+void Mutex::Lock() {
+    const auto rflags = SaveAndDisableInterrupts();
+    Task* current_task = &task_manager->CurrentTask();
+    while (owner_) {
+        waiters_.Wait();
+    }
+    owner_ = current_task;
+    RestoreInterrupts(rflags);
+}
+
+bool Mutex::TryLock() {
+    const auto rflags = SaveAndDisableInterrupts();
+    const bool acquired = owner_ == nullptr;
+    if (acquired) {
+        owner_ = &task_manager->CurrentTask();
+    }
+    RestoreInterrupts(rflags);
+    return acquired;
+}
+
+void Mutex::Unlock() {
+    const auto rflags = SaveAndDisableInterrupts();
+    owner_ = nullptr;
+    waiters_.Wakeup(1);
+    RestoreInterrupts(rflags);
+}
+
+void Semaphore::Down() {
+    const auto rflags = SaveAndDisableInterrupts();
+    while (count_ == 0) {
+        waiters_.Wait();
+    }
+    --count_;
+    RestoreInterrupts(rflags);
+}
+
+bool Semaphore::TryDown() {
+    const auto rflags = SaveAndDisableInterrupts();
+    const bool acquired = count_ > 0;
+    if (acquired) {
+        --count_;
+    }
+    RestoreInterrupts(rflags);
+    return acquired;
+}
+
+void Semaphore::Up(uint64_t n) {
+    const auto rflags = SaveAndDisableInterrupts();
+    count_ += n;
+    waiters_.Wakeup(n);
+    RestoreInterrupts(rflags);
+}
+
+void ConditionVariable::Wait(Mutex& mutex) {
+    const auto rflags = SaveAndDisableInterrupts();
+    // 割り込み禁止のまま Unlock して眠るので，その間の Signal を取りこぼさない
+    mutex.owner_ = nullptr;
+    mutex.waiters_.Wakeup(1);
+    waiters_.Wait();
+    RestoreInterrupts(rflags);
+    mutex.Lock();
+}
+
+void ConditionVariable::Signal() {
+    const auto rflags = SaveAndDisableInterrupts();
+    waiters_.Wakeup(1);
+    RestoreInterrupts(rflags);
+}
+
+void ConditionVariable::Broadcast() {
+    const auto rflags = SaveAndDisableInterrupts();
+    waiters_.WakeupAll();
+    RestoreInterrupts(rflags);
+}
@@ -0,0 +1,113 @@
+/**
+ * @file wait_queue.hpp
+ *
+ * タスクを事象の発生まで眠らせる待ち行列と，それを使った同期機構を集めたファイル．
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+class Task;
+
+/** @brief 何かを待っているタスクの行列．
+ *
+ * 行列の要素は Wait を呼んだタスクのスタック上に置くので，待つたびに
+ * メモリを確保することはない．複数のタスクが同じ行列で待てる．
+ * Wait, Wakeup は割り込みを禁止した状態で呼ぶこと．
+ */
+class WaitQueue {
+    public:
+        static const size_t kAll = std::numeric_limits<size_t>::max();
+
+        WaitQueue() = default;
+        WaitQueue(const WaitQueue&) = delete;
+        WaitQueue& operator=(const WaitQueue&) = delete;
+
+        /** @brief 現在のタスクを行列の末尾に入れて眠らせる．
+         *
+         * 他の理由（メッセージの到着など）で起こされても戻るので，
+         * 呼び出し側は待っている条件をループで確かめ直すこと．
+         *
+         * @param key  WakeupKey で起こす相手を選ぶための値
+         * @return Wakeup, WakeupKey で起こされたら true
+         */
+        bool Wait(uint64_t key = 0);
+        /** @brief 先頭から最大 n 個のタスクを起こす．タイマの再設定などは 1 回にまとめる．
+         * @return 起こしたタスクの数
+         */
+        size_t Wakeup(size_t n = 1);
+        size_t WakeupAll() { return Wakeup(kAll); }
+        /** @brief key を指定して Wait したタスクだけを先頭から最大 n 個起こす． */
+        size_t WakeupKey(uint64_t key, size_t n);
+        bool Empty() const { return head_ == nullptr; }
+
+    private:
+        struct Entry {
+            Task* task;
+            uint64_t key;
+            Entry* prev;
+            Entry* next;
+        };
+
+        Entry* head_{nullptr};
+        Entry* tail_{nullptr};
+
+        void Unlink(Entry* entry);
+        template <class Pred>
+        size_t WakeupIf(size_t n, Pred pred);
+};
+
+/** @brief 眠って待つ排他ロック．割り込みハンドラからは使えない． */
+class Mutex {
+    public:
+        void Lock();
+        bool TryLock();
+        void Unlock();
+        bool Locked() const { return owner_ != nullptr; }
+
+    private:
+        Task* owner_{nullptr};
+        WaitQueue waiters_{};
+
+        friend class ConditionVariable;
+};
+
+/** @brief 計数セマフォ．Up は割り込みハンドラからも呼べる． */
+class Semaphore {
+    public:
+        explicit Semaphore(uint64_t count = 0) : count_{count} {}
+        void Down();
+        bool TryDown();
+        void Up(uint64_t n = 1);
+        uint64_t Count() const { return count_; }
+
+    private:
+        uint64_t count_;
+        WaitQueue waiters_{};
+};
+
+/** @brief 条件変数．Wait は Mutex をロックした状態で呼ぶ． */
+class ConditionVariable {
+    public:
+        void Wait(Mutex& mutex);
+        void Signal();
+        void Broadcast();
+
+    private:
+        WaitQueue waiters_{};
+};
+
+/** @brief スコープを抜けるときに Unlock する． */
+class LockGuard {
+    public:
+        explicit LockGuard(Mutex& mutex) : mutex_{mutex} { mutex_.Lock(); }
+        ~LockGuard() { mutex_.Unlock(); }
+        LockGuard(const LockGuard&) = delete;
+        LockGuard& operator=(const LockGuard&) = delete;
+
+    private:
+        Mutex& mutex_;
+};
@@ -1,6 +1,8 @@
 #include "window.hpp"
 
+#include <algorithm>
 #include "logger.hpp"
+#include "pixel_ops.hpp"
 #include "font.hpp"
 
 namespace {
@@ -45,11 +47,6 @@ namespace {
 }
 
 Window::Window(int width, int height, PixelFormat shadow_format) : width_{width}, height_{height} {
-    data_.resize(height);
-    for(int y = 0; y < height; ++y){
-        data_[y].resize(width);
-    }
-
     FrameBufferConfig config{};
     config.frame_buffer = nullptr;
     config.horizontal_resolution = width;
@@ -70,17 +67,33 @@ void Window::DrawTo(FrameBuffer& dst, Vector2D<int> pos, const Rectangle<int>& a
         return;
     }
 
-    const auto tc = transparent_color_.value();
-    auto& writer = dst.Writer();
-  for (int y = std::max(0, 0 - pos.y);
-       y < std::min(Height(), writer.Height() - pos.y);
-       ++y) {
-    for (int x = std::max(0, 0 - pos.x);
-         x < std::min(Width(), writer.Width() - pos.x);
-         ++x) {
-            const auto c = At(Vector2D<int> {x, y});
-            if(c != tc){
-        writer.Write(pos + Vector2D<int>{x, y}, c);
+    const Rectangle<int> screen_area{{0, 0}, {dst.Writer().Width(), dst.Writer().Height()}};
+    const auto draw_area = area & screen_area & Rectangle<int>{pos, Size()};
+    if (draw_area.size.x <= 0 || draw_area.size.y <= 0) {
+        return;
+    }
+
+    UpdateOpaqueSpans();
+
+    // 不透明な区間のうち draw_area に入る部分だけを写す
+    const bool same_format = dst.Config().pixel_format == shadow_buffer_.Config().pixel_format;
+    const auto src_pos = draw_area.pos - pos;
+    const int src_x_end = src_pos.x + draw_area.size.x;
+    for (int dy = 0; dy < draw_area.size.y; ++dy) {
+        const int src_y = src_pos.y + dy;
+        for (const auto& span : opaque_spans_[src_y]) {
+            const int x0 = std::max(span.x, src_pos.x);
+            const int x1 = std::min(span.x + span.len, src_x_end);
+            if (x0 >= x1) {
+                continue;
+            }
+            if (same_format) {
+                pixel_ops->copy(dst.Row(pos.y + src_y) + pos.x + x0,
+                                shadow_buffer_.Row(src_y) + x0, x1 - x0);
+            } else {
+                for (int x = x0; x < x1; ++x) {
+                    dst.Writer().Write(pos + Vector2D<int>{x, src_y}, At({x, src_y}));
+                }
             }
         }
     }
@@ -88,19 +101,78 @@ void Window::DrawTo(FrameBuffer& dst, Vector2D<int> pos, const Rectangle<int>& a
 
 void Window::SetTransparentColor(std::optional<PixelColor> c){
     transparent_color_ = c;
+    MarkDirty(0, height_);
+}
+
+void Window::MarkDirty(int y, int height) {
+    if (!transparent_color_ || height <= 0) {
+        return;
+    }
+    y = std::max(y, 0);
+    const int bottom = std::min(y + height, height_);
+    if (dirty_top_ >= dirty_bottom_) {
+        dirty_top_ = y;
+        dirty_bottom_ = bottom;
+    } else {
+        dirty_top_ = std::min(dirty_top_, y);
+        dirty_bottom_ = std::max(dirty_bottom_, bottom);
+    }
+}
+
+/** 書き換えられた行だけ，透過色と比べて不透明な区間を数え直す． */
+void Window::UpdateOpaqueSpans() {
+    if (dirty_top_ >= dirty_bottom_) {
+        return;
+    }
+    opaque_spans_.resize(height_);
+
+    const auto tc = transparent_color_.value();
+    const auto& config = shadow_buffer_.Config();
+    // 画素を同じ形式の数値にしておけば，透過色との比較も 32 ビットでできる
+    const uint32_t key = config.pixel_format == kPixelRGBResv8BitPerColor
+                         ? ToRGBResv8BitPerColor(tc) : ToBGRResv8BitPerColor(tc);
+    for (int y = dirty_top_; y < dirty_bottom_; ++y) {
+        auto& spans = opaque_spans_[y];
+        spans.clear();
+        const uint32_t* row = shadow_buffer_.Row(y);
+        int x = 0;
+        while (x < width_) {
+            while (x < width_ && row[x] == key) {
+                ++x;
+            }
+            const int begin = x;
+            while (x < width_ && row[x] != key) {
+                ++x;
+            }
+            if (begin < x) {
+                spans.push_back({begin, x - begin});
+            }
+        }
+    }
+    dirty_top_ = dirty_bottom_ = 0;
 }
 
 Window::WindowWriter* Window::Writer() {
     return &writer_;
 }
 
-const PixelColor& Window::At(Vector2D<int> pos) const {
-    return data_[pos.y][pos.x];
+PixelColor Window::At(Vector2D<int> pos) const {
+    return shadow_buffer_.At(pos);
 }
 
 void Window::Write(Vector2D<int> pos, PixelColor c){
-    data_[pos.y][pos.x] = c;
     shadow_buffer_.Writer().Write(pos, c);
+    MarkDirty(pos.y, 1);
+}
+
+void Window::FillSpan(Vector2D<int> pos, int len, const PixelColor& c){
+    shadow_buffer_.Writer().FillSpan(pos, len, c);
+    MarkDirty(pos.y, 1);
+}
+
+void Window::WriteRow(Vector2D<int> pos, const PixelColor* colors, int len){
+    shadow_buffer_.Writer().WriteRow(pos, colors, len);
+    MarkDirty(pos.y, 1);
 }
 
 int Window::Width() const {
@@ -117,6 +189,7 @@ Vector2D<int> Window::Size() const {
 
 void Window::Move(Vector2D<int> dst_pos, const Rectangle<int>& src){
     shadow_buffer_.Move(dst_pos, src);
+    MarkDirty(dst_pos.y, src.size.y);
 }
 
 WindowRegion Window::GetWindowRegion(Vector2D<int> pos){
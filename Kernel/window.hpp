@@ -21,6 +21,12 @@ class Window {
                 virtual void Write(Vector2D<int> pos, const PixelColor& c) override{
                     window_.Write(pos, c);
                 }
+                virtual void FillSpan(Vector2D<int> pos, int len, const PixelColor& c) override {
+                    window_.FillSpan(pos, len, c);
+                }
+                virtual void WriteRow(Vector2D<int> pos, const PixelColor* colors, int len) override {
+                    window_.WriteRow(pos, colors, len);
+                }
                 virtual int Width() const override { return window_.Width(); }
                 virtual int Height() const override { return window_.Height(); }
             private:
@@ -35,16 +41,22 @@ class Window {
 
   void DrawTo(FrameBuffer& dst, Vector2D<int> pos, const Rectangle<int>& area);
         void SetTransparentColor(std::optional<PixelColor> c);
+        /** @brief 透過色を持たず，下のレイヤを完全に隠すなら true． */
+        bool IsOpaque() const { return !transparent_color_; }
         WindowWriter* Writer();
 
-        const PixelColor& At(Vector2D<int> pos) const;
+        PixelColor At(Vector2D<int> pos) const;
         void Write(Vector2D<int> pos, PixelColor c);
+        void FillSpan(Vector2D<int> pos, int len, const PixelColor& c);
+        void WriteRow(Vector2D<int> pos, const PixelColor* colors, int len);
 
         int Width() const ;
         int Height() const ;
         Vector2D<int> Size() const;
 
         void Move(Vector2D<int> dst_pos, const Rectangle<int>& src);
+        /** @brief ウィンドウの画素そのもの．MapWindow でアプリに見せるのに使う． */
+        FrameBuffer& Buffer() { return shadow_buffer_; }
 
   // #@@range_begin(window_activate)
         virtual void Activate() {}
@@ -53,11 +65,24 @@ class Window {
 
     private:
         int width_, height_;
-        std::vector<std::vector<PixelColor>> data_{};
         WindowWriter writer_{*this};
         std::optional<PixelColor> transparent_color_{std::nullopt};
 
+        /** @brief ウィンドウの画素．画面と同じ形式で，これ以外に画素の写しは持たない． */
         FrameBuffer shadow_buffer_{};
+
+        /** @brief 1 行の中で透過色でない画素が続く区間 [x, x + len)． */
+        struct OpaqueSpan {
+            int x, len;
+        };
+        /** @brief 透過色を持つときの，行ごとの不透明な区間．DrawTo はここだけを写す． */
+        std::vector<std::vector<OpaqueSpan>> opaque_spans_{};
+        /** @brief 区間を作り直す必要がある行の範囲 [dirty_top_, dirty_bottom_)． */
+        int dirty_top_{0}, dirty_bottom_{0};
+
+        /** @brief 画素を書き換えた行を記録する．透過色がなければ何もしない． */
+        void MarkDirty(int y, int height);
+        void UpdateOpaqueSpans();
 };
 
 // #@@range_begin(tlw)
@@ -74,6 +99,12 @@ class ToplevelWindow : public Window {
                 virtual void Write(Vector2D<int> pos, const PixelColor& c) override {
                     window_.Write(pos + kTopLeftMargin, c);
                 }
+                virtual void FillSpan(Vector2D<int> pos, int len, const PixelColor& c) override {
+                    window_.FillSpan(pos + kTopLeftMargin, len, c);
+                }
+                virtual void WriteRow(Vector2D<int> pos, const PixelColor* colors, int len) override {
+                    window_.WriteRow(pos + kTopLeftMargin, colors, len);
+                }
                 virtual int Width() const override {
                     return window_.Width() - kTopLeftMargin.x - kBottomRightMargin.x; }
                 virtual int Height() const override {
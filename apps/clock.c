@@ -0,0 +1,52 @@
+#include "syscall.h"
+#include "../Kernel/clock_page.hpp"
+
+static const struct ClockPage* const clock_page =
+    (const struct ClockPage*)CLOCK_PAGE_ADDR;
+
+static uint64_t ReadTSC(void){
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* 時計ページから現在時刻を読む．invariant TSC が使えなければ 0 を返す． */
+static int ReadClockPage(uint64_t* ns, uint32_t* timer_freq){
+    uint32_t seq;
+    uint64_t mult, base, tsc;
+    do {
+        seq = clock_page->sequence;
+        __asm__ volatile("" ::: "memory");
+        mult = clock_page->tsc_ns_mult;
+        base = clock_page->tsc_base;
+        *timer_freq = clock_page->timer_freq;
+        tsc = ReadTSC();
+        __asm__ volatile("" ::: "memory");
+    } while ((seq & 1) || seq != clock_page->sequence);
+
+    if (mult == 0){
+        return 0;
+    }
+    *ns = (uint64_t)(((unsigned __int128)(tsc - base) * mult) >> 32);
+    return 1;
+}
+
+struct SyscallResult FastGetTimeNs(void){
+    uint64_t ns;
+    uint32_t timer_freq;
+    if (!ReadClockPage(&ns, &timer_freq)){
+        return SyscallGetTimeNs();
+    }
+    struct SyscallResult res = { ns, 0 };
+    return res;
+}
+
+struct SyscallResult FastGetCurrentTick(void){
+    uint64_t ns;
+    uint32_t timer_freq;
+    if (!ReadClockPage(&ns, &timer_freq)){
+        return SyscallGetCurrentTick();
+    }
+    struct SyscallResult res = { ns / (1000000000u / timer_freq), timer_freq };
+    return res;
+}
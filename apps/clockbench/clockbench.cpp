@@ -0,0 +1,33 @@
+#include <cstdio>
+#include <cstdlib>
+#include "../syscall.h"
+
+template <class F>
+uint64_t MeasureNsPerCall(int n, F f){
+    const auto ns_start = SyscallGetTimeNs().value;
+    for(int i = 0; i < n; ++i){
+        f();
+    }
+    const auto ns_end = SyscallGetTimeNs().value;
+    return (ns_end - ns_start) / n;
+}
+
+extern "C" void main(int argc, char** argv){
+    int n = 100000;
+    if (argc >= 2){
+        n = atoi(argv[1]);
+    }
+    if (n <= 0){
+        exit(1);
+    }
+
+    const auto syscall_ns = MeasureNsPerCall(n, []{ SyscallGetTimeNs(); });
+    const auto fast_ns = MeasureNsPerCall(n, []{ FastGetTimeNs(); });
+    const auto syscall_tick_ns = MeasureNsPerCall(n, []{ SyscallGetCurrentTick(); });
+    const auto fast_tick_ns = MeasureNsPerCall(n, []{ FastGetCurrentTick(); });
+
+    printf("GetTimeNs:      syscall %lu ns, clock page %lu ns\n", syscall_ns, fast_ns);
+    printf("GetCurrentTick: syscall %lu ns, clock page %lu ns\n",
+           syscall_tick_ns, fast_tick_ns);
+    exit(0);
+}
@@ -22,6 +22,7 @@ struct Vector2D {
 
 void DrawObj(uint64_t layer_id);
 void DrawSurface(uint64_t layer_id, int sur);
+void FillRect(uint64_t layer_id, int x, int y, int w, int h, uint32_t color);
 bool Sleep(unsigned long ms);
 
 const int kScale = 50, kMargin = 10;
@@ -40,6 +41,10 @@ const array<uint32_t, kSurface.size()> kColor{
 array<Vector3D<double>, kCube.size()> vert;
 array<double, kSurface.size()> centerz4;
 array<Vector2D<int>, kCube.size()> scr;
+
+// 1 フレーム分の描画命令を溜めて，まとめてカーネルに渡す
+alignas(8) uint8_t draw_data[16 * 1024];
+DrawBuffer draw_buf;
 // #@@range_end(constants)
 
 // #@@range_begin(main)
@@ -50,6 +55,8 @@ extern "C" void main(int argc, char** argv) {
     exit(err_openwin);
   }
 
+  DrawBufferInit(&draw_buf, draw_data, sizeof(draw_data));
+
   int thx = 0, thy = 0, thz = 0;
   const double to_rad = 3.14159265358979323 / 0x8000;
   for (;;) {
@@ -79,10 +86,9 @@ extern "C" void main(int argc, char** argv) {
     }
 
     // 画面を一旦クリアし，立方体を描画
-    SyscallWinFillRectangle(layer_id | LAYER_NO_REDRAW,
-                            4, 24, kCanvasSize, kCanvasSize, 0);
-    DrawObj(layer_id | LAYER_NO_REDRAW);
-    SyscallWinRedraw(layer_id);
+    FillRect(layer_id, 4, 24, kCanvasSize, kCanvasSize, 0);
+    DrawObj(layer_id);
+    DrawBufferSubmit(layer_id, &draw_buf);
     if (Sleep(50)) {
       break;
     }
@@ -155,7 +161,15 @@ void DrawSurface(uint64_t layer_id, int sur) {
   for (int y = ymin; y <= ymax; y++) {
     int p0x = min(y2x_up[y], y2x_down[y]);
     int p1x = max(y2x_up[y], y2x_down[y]);
-    SyscallWinFillRectangle(layer_id, 4 + p0x, 24 + y, p1x - p0x + 1, 1, kColor[sur]);
+    FillRect(layer_id, 4 + p0x, 24 + y, p1x - p0x + 1, 1, kColor[sur]);
+  }
+}
+
+void FillRect(uint64_t layer_id, int x, int y, int w, int h, uint32_t color) {
+  if (!DrawBufferFill(&draw_buf, x, y, w, h, color)) {
+    // バッファが一杯なら，再描画せずにそれまでの分を実行させる
+    DrawBufferSubmit(layer_id | LAYER_NO_REDRAW, &draw_buf);
+    DrawBufferFill(&draw_buf, x, y, w, h, color);
   }
 }
 
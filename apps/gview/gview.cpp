@@ -86,15 +86,31 @@ extern "C" void main(int argc, char** argv) {
     }
     const uint64_t layer_id = window.value;
 
-    for(int y = 0; y < height; ++y){
-        for(int x = 0 ; x < width; ++x){
-            uint32_t c = get_color(&image_data[bytes_per_pixel * (y * width + x)]);
-            SyscallWinFillRectangle(layer_id | LAYER_NO_REDRAW,
-                            4 + x, 24 + y, 1, 1, c);
+    // ウィンドウの画素を直接書けるなら，1 画素ずつシステムコールを呼ばずに済む
+    WindowSurface surface;
+    if(SyscallMapWindow(layer_id, &surface).error == 0){
+        for(int y = 0; y < height; ++y){
+            uint32_t* row = &surface.pixels[surface.stride * (24 + y) + 4];
+            for(int x = 0 ; x < width; ++x){
+                uint32_t c = get_color(&image_data[bytes_per_pixel * (y * width + x)]);
+                if(surface.format == kPixelRGBResv8BitPerColor){
+                    c = (c & 0x00ff00) | (c >> 16) | ((c & 0xff) << 16);
+                }
+                row[x] = c;
+            }
         }
+        SyscallWinDamage(layer_id, 4, 24, width, height);
+    } else {
+        for(int y = 0; y < height; ++y){
+            for(int x = 0 ; x < width; ++x){
+                uint32_t c = get_color(&image_data[bytes_per_pixel * (y * width + x)]);
+                SyscallWinFillRectangle(layer_id | LAYER_NO_REDRAW,
+                                4 + x, 24 + y, 1, 1, c);
+            }
+        }
+        SyscallWinRedraw(layer_id);
     }
 
-    SyscallWinRedraw(layer_id);
     WaitEvent();
 
     SyscallCloseWindow(layer_id);
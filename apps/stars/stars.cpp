@@ -19,7 +19,7 @@ extern "C" void main(int argc, char** argv){
         num_stars = atoi(argv[1]);
     }
 
-    auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+    const auto ns_start = SyscallGetTimeNs().value;
 
     std::default_random_engine rand_engine;
     std::uniform_int_distribution x_dist(0, kWidth - 2), y_dist(0, kHeight - 2);
@@ -31,8 +31,8 @@ extern "C" void main(int argc, char** argv){
     }
     SyscallWinRedraw(layer_id);
 
-    auto tick_end = SyscallGetCurrentTick();
-    printf("%d stars in %lu ms.\n", num_stars, (tick_end.value - tick_start) * 1000 / timer_freq);
+    const auto ns_end = SyscallGetTimeNs().value;
+    printf("%d stars in %lu us.\n", num_stars, (ns_end - ns_start) / 1000);
 
     exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include "sync.h"
+#include "syscall.h"
+
+static uint32_t CompareExchange(uint32_t* p, uint32_t expected, uint32_t desired){
+    __atomic_compare_exchange_n(p, &expected, desired, 0,
+                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    return expected;
+}
+
+void AppMutexLock(struct AppMutex* mutex){
+    uint32_t c = CompareExchange(&mutex->state, 0, 1);
+    if (c == 0){
+        return;
+    }
+
+    if (c != 2){
+        c = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+    }
+    while (c != 0){
+        SyscallFutexWait(&mutex->state, 2);
+        c = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+int AppMutexTryLock(struct AppMutex* mutex){
+    return CompareExchange(&mutex->state, 0, 1) == 0;
+}
+
+void AppMutexUnlock(struct AppMutex* mutex){
+    if (__atomic_exchange_n(&mutex->state, 0, __ATOMIC_RELEASE) == 2){
+        SyscallFutexWake(&mutex->state, 1);
+    }
+}
+
+void AppCondWait(struct AppCondVar* cond, struct AppMutex* mutex){
+    const uint32_t seq = __atomic_load_n(&cond->seq, __ATOMIC_RELAXED);
+    AppMutexUnlock(mutex);
+    SyscallFutexWait(&cond->seq, seq);
+    AppMutexLock(mutex);
+}
+
+void AppCondSignal(struct AppCondVar* cond){
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+    SyscallFutexWake(&cond->seq, 1);
+}
+
+void AppCondBroadcast(struct AppCondVar* cond){
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+    SyscallFutexWake(&cond->seq, (size_t)-1);
+}
+
+/* カーネルが新しいスレッドで最初に呼ぶ．args はスレッドのスタック上の { func, arg } */
+static void ThreadStart(int thread_id, uint64_t* args){
+    int (*func)(void*) = (int (*)(void*))args[0];
+    SyscallExit(func((void*)args[1]));
+}
+
+uint64_t AppThreadCreate(int (*func)(void*), void* arg){
+    struct SyscallResult res =
+        SyscallCreateThread(ThreadStart, (uint64_t)func, (uint64_t)arg);
+    return res.error ? 0 : res.value;
+}
+
+int AppThreadJoin(uint64_t thread_id, int* exit_code){
+    struct SyscallResult res = SyscallJoinThread(thread_id);
+    if (res.error){
+        return res.error;
+    }
+    if (exit_code){
+        *exit_code = (int)res.value;
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifdef __cplusplus
+#include <cstdint>
+
+extern "C"{
+#else
+#include <stdint.h>
+#endif
+
+    /* futex を使ったアプリ用の同期機構．競合しなければシステムコールを呼ばない． */
+
+    /* 0 : 解放，1 : ロック中，2 : ロック中で待っているタスクがいるかもしれない */
+    struct AppMutex {
+        uint32_t state;
+    };
+#define APP_MUTEX_INITIALIZER { 0 }
+
+    void AppMutexLock(struct AppMutex* mutex);
+    int AppMutexTryLock(struct AppMutex* mutex);
+    void AppMutexUnlock(struct AppMutex* mutex);
+
+    struct AppCondVar {
+        uint32_t seq;
+    };
+#define APP_COND_INITIALIZER { 0 }
+
+    void AppCondWait(struct AppCondVar* cond, struct AppMutex* mutex);
+    void AppCondSignal(struct AppCondVar* cond);
+    void AppCondBroadcast(struct AppCondVar* cond);
+
+    /* 同じアドレス空間で動くスレッド．func の戻り値が終了コードになる．
+     * 作れたらスレッド ID を，失敗したら 0 を返す． */
+    uint64_t AppThreadCreate(int (*func)(void*), void* arg);
+    /* スレッドの終了を待つ．成功したら 0 を返し，*exit_code に終了コードを入れる． */
+    int AppThreadJoin(uint64_t thread_id, int* exit_code);
+
+#ifdef __cplusplus
+}
+#endif
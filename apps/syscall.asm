@@ -26,4 +26,14 @@ define_syscall OpenFile,            0x8000000c
 define_syscall ReadFile,            0x8000000d
 define_syscall DemandPages,         0x8000000e
 define_syscall MapFile,             0x8000000f
-
+define_syscall GetTimeNs,           0x80000010
+define_syscall SetNice,             0x80000011
+define_syscall FutexWait,           0x80000012
+define_syscall FutexWake,           0x80000013
+define_syscall CreateThread,        0x80000014
+define_syscall JoinThread,          0x80000015
+define_syscall GetCPUUsage,         0x80000016
+define_syscall SetAffinity,         0x80000017
+define_syscall MapWindow,           0x80000018
+define_syscall WinDamage,           0x80000019
+define_syscall WinDrawBatch,        0x8000001a
@@ -1,15 +1,19 @@
 #ifdef __cplusplus
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 extern "C"{
 #else
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #endif
 
 #include "../Kernel/logger.hpp"
 #include "../Kernel/app_event.hpp"
+#include "../Kernel/app_surface.hpp"
+#include "../Kernel/app_draw.hpp"
 
     struct SyscallResult{
         uint64_t value;
@@ -37,6 +41,104 @@ extern "C"{
     struct SyscallResult SyscallReadFile(int fd, void* buf, size_t count);
     struct SyscallResult SyscallDemandPages(size_t pages, const int flags);
     struct SyscallResult SyscallMapFile(const int fd, size_t* file_size, const int flags);
+    struct SyscallResult SyscallGetTimeNs();
+    struct SyscallResult SyscallSetNice(int nice);
+    struct SyscallResult SyscallFutexWait(uint32_t* addr, uint32_t expected);
+    struct SyscallResult SyscallFutexWake(uint32_t* addr, size_t n);
+    struct SyscallResult SyscallCreateThread(void (*start)(int, uint64_t*),
+                                             uint64_t func, uint64_t arg);
+    struct SyscallResult SyscallJoinThread(uint64_t thread_id);
+    /* CPU の使用率（0.1% 単位） */
+    struct SyscallResult SyscallGetCPUUsage(int cpu);
+    /* 実行してよい CPU の集合（ビット i が CPU i）を記録し，それまでの集合を返す．
+     * 今は CPU 0 しか動かしていないので，記録するだけでスケジューリングには効かない */
+    struct SyscallResult SyscallSetAffinity(uint64_t mask);
+    /* ウィンドウの画素を直接書けるようにマップし，surface に情報を書く */
+    struct SyscallResult SyscallMapWindow(uint64_t layer_id_flags, struct WindowSurface* surface);
+    /* マップした画素のうち (x, y, w, h) を書き換えたことを知らせ，画面に反映させる */
+    struct SyscallResult SyscallWinDamage(uint64_t layer_id_flags, int x, int y, int w, int h);
+    /* buf に並べた描画命令（struct DrawCommand）をまとめて実行し，1 回だけ再描画する */
+    struct SyscallResult SyscallWinDrawBatch(uint64_t layer_id_flags, const void* buf, size_t bytes);
+
+    /* SyscallWinDrawBatch に渡す描画命令を組み立てるバッファ．
+     * DrawBuffer* 関数は空きが足りなければ何もせず 0 を返すので，
+     * DrawBufferSubmit で送ってからやり直す． */
+    struct DrawBuffer {
+        uint8_t* data;   /* 8 バイト境界に揃えること */
+        size_t capacity;
+        size_t used;
+    };
+
+    static inline void DrawBufferInit(struct DrawBuffer* b, void* data, size_t capacity) {
+        b->data = (uint8_t*)data;
+        b->capacity = capacity;
+        b->used = 0;
+    }
+
+    /* payload バイトのデータが続く命令を 1 つ確保する．空きがなければ NULL */
+    static inline struct DrawCommand* DrawBufferAppend(struct DrawBuffer* b, uint32_t type,
+                                                       int x, int y, int w, int h,
+                                                       uint32_t color, size_t payload) {
+        const size_t size = (sizeof(struct DrawCommand) + payload + 7) & ~(size_t)7;
+        if (b->capacity - b->used < size) {
+            return NULL;
+        }
+        struct DrawCommand* cmd = (struct DrawCommand*)(b->data + b->used);
+        cmd->type = type;
+        cmd->size = (uint32_t)size;
+        cmd->x = x;
+        cmd->y = y;
+        cmd->w = w;
+        cmd->h = h;
+        cmd->color = color;
+        cmd->reserved = 0;
+        b->used += size;
+        return cmd;
+    }
+
+    static inline int DrawBufferFill(struct DrawBuffer* b, int x, int y, int w, int h, uint32_t color) {
+        return DrawBufferAppend(b, kDrawFill, x, y, w, h, color, 0) != NULL;
+    }
+
+    static inline int DrawBufferLine(struct DrawBuffer* b, int x0, int y0, int x1, int y1, uint32_t color) {
+        return DrawBufferAppend(b, kDrawLine, x0, y0, x1, y1, color, 0) != NULL;
+    }
+
+    static inline int DrawBufferText(struct DrawBuffer* b, int x, int y, uint32_t color, const char* s) {
+        const size_t len = strlen(s) + 1;
+        if (len > kDrawTextMaxBytes) {
+            return 0;
+        }
+        struct DrawCommand* cmd = DrawBufferAppend(b, kDrawText, x, y, 0, 0, color, len);
+        if (cmd == NULL) {
+            return 0;
+        }
+        memcpy(cmd + 1, s, len);
+        return 1;
+    }
+
+    /* pixels は 0xRRGGBB の画素が w * h 個並んだもの */
+    static inline int DrawBufferBlit(struct DrawBuffer* b, int x, int y, int w, int h,
+                                     const uint32_t* pixels) {
+        const size_t bytes = sizeof(uint32_t) * w * h;
+        struct DrawCommand* cmd = DrawBufferAppend(b, kDrawBlit, x, y, w, h, 0, bytes);
+        if (cmd == NULL) {
+            return 0;
+        }
+        memcpy(cmd + 1, pixels, bytes);
+        return 1;
+    }
+
+    /* 溜めた命令を実行させてバッファを空にする */
+    static inline struct SyscallResult DrawBufferSubmit(uint64_t layer_id_flags, struct DrawBuffer* b) {
+        struct SyscallResult res = SyscallWinDrawBatch(layer_id_flags, b->data, b->used);
+        b->used = 0;
+        return res;
+    }
+
+    /* 時計ページを読むだけでカーネルに入らない SyscallGetTimeNs, SyscallGetCurrentTick */
+    struct SyscallResult FastGetTimeNs(void);
+    struct SyscallResult FastGetCurrentTick(void);
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file